@@ -0,0 +1,293 @@
+/*
+
+ Corvux benchmarks
+
+ Runs the editor core without a terminal on generated files and reports
+ the time and the heap bytes requested per operation.
+
+ make bench                      1K to 10M lines
+ make bench BENCH_LINES=100000   stop at 100K lines
+
+*/
+
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include "editor.h"
+#include "errors.h"
+#include "lexer.h"
+#include "lines.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_ROWS 48
+#define BENCH_COLS 160
+#define BENCH_EDITS 100000
+#define BENCH_HL_ROWS 1000000
+#define BENCH_FRAMES 1000
+#define BENCH_LONG_LINE (16 << 20)
+
+static const char *LINES[] = {
+  "#include <stdio.h>",
+  "",
+  "/* generated for the benchmark,",
+  "   spans a few lines */",
+  "static int counter = 0;",
+  "int add(int a, int b){",
+  "\treturn a + b; // sum",
+  "}",
+  "void walk(char *s, int len){",
+  "\tfor (int i = 0; i < len; i++){",
+  "\t\tif (s[i] == '\\n') counter++;",
+  "\t\telse printf(\"%c\", s[i]);",
+  "\t}",
+  "}",
+  "#define LIMIT 4096",
+  "struct pair { long key; double value; };",
+};
+
+#define NLINES (sizeof(LINES) / sizeof(LINES[0]))
+
+/*  allocation counting, malloc and friends are wrapped at link time  */
+
+static size_t alloc_bytes = 0;  // the lexing threads allocate too, only touched atomically
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size){
+  __atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size){
+  __atomic_fetch_add(&alloc_bytes, n * size, __ATOMIC_RELAXED);
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size){
+  __atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+  return __real_realloc(p, size);
+}
+
+/*  measuring  */
+
+struct benchRun {
+  long long start_ns;
+  size_t start_bytes;
+};
+
+static FILE *out;
+
+static long long benchNow(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void benchStart(struct benchRun *r){
+  r->start_bytes = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED);
+  r->start_ns = benchNow();
+}
+
+static void benchStop(struct benchRun *r, const char *name, int lines, int ops){
+  long long ns = benchNow() - r->start_ns;
+  size_t bytes = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED) - r->start_bytes;
+  if (ops < 1) ops = 1;
+  fprintf(out, "%-12s %10d %10d %12.1f %12.1f\n", name, lines, ops,
+          (double)ns / ops, (double)bytes / ops);
+  fflush(out);
+}
+
+/*  input files  */
+
+static void benchWriteFile(const char *path, int lines){
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) die("fopen");
+
+  for (int i = 0; i < lines; i++){
+    fputs(LINES[i % NLINES], fp);
+    fputc('\n', fp);
+  }
+  if (fclose(fp) == EOF) die("fclose");
+}
+
+/*  benchmarks  */
+
+static void benchFile(int lines){
+  char path[] = "/tmp/corvux-bench-XXXXXX.c";
+  char saved[] = "/tmp/corvux-bench-XXXXXX.c";
+  int fd = mkstemps(path, 2);
+  if (fd == -1) die("mkstemps");
+  close(fd);
+  fd = mkstemps(saved, 2);
+  if (fd == -1) die("mkstemps");
+  close(fd);
+
+  benchWriteFile(path, lines);
+  initEditorSize(BENCH_ROWS, BENCH_COLS);
+  srand(lines);
+
+  struct benchRun r;
+
+  benchStart(&r);
+  editorOpen(path);
+  editorLoadUntil(INT_MAX);
+  benchStop(&r, "open", lines, lines);
+
+  // what the worker and its helpers do behind the first frames
+  benchStart(&r);
+  while (editorSyntaxFrontier() < editorNumRows()){
+    editorSyntaxIdle();
+    usleep(100);
+  }
+  benchStop(&r, "highlight-all", lines, lines);
+
+  int n = lines < BENCH_HL_ROWS ? lines : BENCH_HL_ROWS;
+  benchStart(&r);
+  for (int i = 0; i < n; i++) editorUpdateRow(i);
+  benchStop(&r, "highlight", lines, n);
+
+  benchStart(&r);
+  for (int i = 0; i < BENCH_EDITS; i++){
+    editorRowInsertChar(rand() % editorNumRows(), rand() % 64, 'x');
+  }
+  benchStop(&r, "insert", lines, BENCH_EDITS);
+
+  benchStart(&r);
+  for (int i = 0; i < BENCH_EDITS; i++){
+    editorRowDeleteChar(rand() % editorNumRows(), rand() % 64);
+  }
+  benchStop(&r, "delete", lines, BENCH_EDITS);
+
+  benchStart(&r);
+  for (int i = 0; i < BENCH_EDITS; i++){
+    const char *s = LINES[i % NLINES];
+    editorInsertRow((char *)s, rand() % (editorNumRows() + 1), strlen(s));
+  }
+  benchStop(&r, "insert-row", lines, BENCH_EDITS);
+
+  benchStart(&r);
+  for (int i = 0; i < BENCH_EDITS; i++){
+    editorDeleteRow(rand() % editorNumRows());
+  }
+  benchStop(&r, "delete-row", lines, BENCH_EDITS);
+
+  // frames go to /dev/null, each one jumps somewhere else in the file
+  int null = open("/dev/null", O_WRONLY);
+  int tty = dup(STDOUT_FILENO);
+  if (null == -1 || tty == -1) die("open");
+  dup2(null, STDOUT_FILENO);
+
+  benchStart(&r);
+  for (int i = 0; i < BENCH_FRAMES; i++){
+    editorSetCursor(rand() % editorNumRows(), 0);
+    editorRefreshScreen();
+  }
+  benchStop(&r, "render", lines, BENCH_FRAMES);
+
+  // a line further down every frame, the text area scrolls rather than being redrawn
+  benchStart(&r);
+  for (int i = 0; i < BENCH_FRAMES; i++){
+    editorSetCursor((BENCH_ROWS + i) % editorNumRows(), 0);
+    editorRefreshScreen();
+  }
+  benchStop(&r, "scroll", lines, BENCH_FRAMES);
+
+  dup2(tty, STDOUT_FILENO);
+  close(tty);
+  close(null);
+
+  benchStart(&r);
+  editorSave(saved);
+  benchStop(&r, "save", lines, lines);
+
+  benchStart(&r);
+  initEditorSize(BENCH_ROWS, BENCH_COLS);
+  benchStop(&r, "close", lines, lines);
+
+  // the viewer maps the file and indexes it in the background, jumps then find lines in the index
+  int done;
+  benchStart(&r);
+  editorView(path);
+  benchStop(&r, "view", lines, 1);
+
+  benchStart(&r);
+  while (linesIndexCount(&done), !done) usleep(100);
+  benchStop(&r, "index", lines, lines);
+
+  benchStart(&r);
+  for (int i = 0; i < BENCH_FRAMES; i++) editorGotoLine(rand() % lines);
+  benchStop(&r, "goto", lines, BENCH_FRAMES);
+
+  initEditorSize(BENCH_ROWS, BENCH_COLS);
+  unlink(path);
+  unlink(saved);
+}
+
+/* one line of BENCH_LONG_LINE bytes with tabs in it, the cursor jumps along it */
+static void benchLongLine(){
+  char path[] = "/tmp/corvux-bench-XXXXXX.c";
+  int fd = mkstemps(path, 2);
+  if (fd == -1) die("mkstemps");
+  close(fd);
+
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) die("fopen");
+  for (int n = 0; n < BENCH_LONG_LINE; n += 8) fputs("x = 1;\t ", fp);
+  fputc('\n', fp);
+  if (fclose(fp) == EOF) die("fclose");
+
+  initEditorSize(BENCH_ROWS, BENCH_COLS);
+  editorOpen(path);
+  editorLoadUntil(INT_MAX);
+
+  int null = open("/dev/null", O_WRONLY);
+  int tty = dup(STDOUT_FILENO);
+  if (null == -1 || tty == -1) die("open");
+  dup2(null, STDOUT_FILENO);
+
+  struct benchRun r;
+  editorRefreshScreen();
+  benchStart(&r);
+  for (int i = 0; i < BENCH_FRAMES; i++){
+    editorSetCursor(0, rand() % BENCH_LONG_LINE);
+    editorRefreshScreen();
+  }
+  benchStop(&r, "long-line", 1, BENCH_FRAMES);
+
+  benchStart(&r);
+  for (int i = 0; i < BENCH_FRAMES; i++){
+    editorRowInsertChar(0, rand() % BENCH_LONG_LINE, i % 8 ? 'x' : '\t');
+  }
+  benchStop(&r, "long-insert", 1, BENCH_FRAMES);
+
+  dup2(tty, STDOUT_FILENO);
+  close(tty);
+  close(null);
+  unlink(path);
+}
+
+int main(int argc, char *argv[]){
+  int max = argc >= 2 ? atoi(argv[1]) : 10000000;
+
+  out = fdopen(dup(STDOUT_FILENO), "w");
+  if (out == NULL) die("fdopen");
+
+  initLexer();
+  fprintf(out, "%-12s %10s %10s %12s %12s\n", "op", "lines", "ops", "ns/op", "bytes/op");
+  for (int lines = 1000; lines <= max; lines *= 10){
+    benchFile(lines);
+  }
+  benchLongLine();
+
+  editorFree();
+  return 0;
+}
@@ -14,6 +14,7 @@
 #include "errors.h"
 #include "lexer.h"
 #include <stdlib.h>
+#include <string.h>
 #include <termios.h>
 #include <unistd.h>
 
@@ -25,6 +26,7 @@ struct termios termios_orig;
 
 
 void disableRawMode(){
+  write(STDOUT_FILENO, "\x1b[?2004l", 8);  // bracketed paste off
   if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &termios_orig) == -1) die("tcsetattr");
 }
 
@@ -37,10 +39,12 @@ void enableRawMode(){
   termios_raw.c_oflag &= ~(OPOST);
   termios_raw.c_cflag |= (CS8);
   termios_raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  // reads never block, the editor polls for input
   termios_raw.c_cc[VMIN] = 0;
-  termios_raw.c_cc[VTIME] = 1;
+  termios_raw.c_cc[VTIME] = 0;
 
   if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &termios_raw) == -1) die("tcsetattr");
+  write(STDOUT_FILENO, "\x1b[?2004h", 8);  // pastes arrive between ESC[200~ and ESC[201~
 }
 
 int main(int argc, char *argv[]){
@@ -49,7 +53,10 @@ int main(int argc, char *argv[]){
   initEditor();
   initLexer();
 
-  if(argc>=2){
+  // -R opens the file read-only in the viewer
+  if(argc>=3 && !strcmp(argv[1], "-R")){
+    editorView(argv[2]);
+  } else if(argc>=2){
     editorOpen(argv[1]);
   }
 
@@ -5,15 +5,30 @@
 
 #include "editor.h"
 #include "errors.h"
+#include "lines.h"
+#include "rows.h"
+#include "screen.h"
+#include "search.h"
+#include "slab.h"
+#include "undo.h"
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #define CTRL_KEY(k) ((k) & 0x1f)
@@ -21,6 +36,32 @@
 #define TAB_STOP 3
 #define LEFT_PADDING 5
 #define QUIT_PERSISTENCE 3
+#define LOAD_CHUNK (1<<22)
+#define LOAD_BATCH 256     // lines split before they are handed to the rows at once
+#define SAVE_IOV 1024
+#define SEARCH_SPAN (1<<20)
+#define HL_MATCH 32  // past the lexer's token types
+#ifndef UNDO_LIMIT
+#define UNDO_LIMIT (1<<20)
+#endif
+#define HL_PENDING_MAX 16
+#define HL_SYNC_ROWS 1024
+#define HL_BATCH_BYTES (1<<23)  // text handed to the worker at once, per lexing thread
+#define HL_CHUNK_BYTES (1<<18)  // least text worth a thread of its own
+#define HL_THREADS_MAX 16
+#define RENDER_CACHE_ROWS 8192  // renders built before the oldest half is dropped
+#define HL_PATCH_MIN 4096  // rows this long are patched around an edit rather than rebuilt
+#define HL_MARK_SPAN 256   // bytes between the points lexing of such a row can restart from
+#define INPUT_CHUNK 4096
+#define INPUT_WAIT_MS 100  // how long the rest of an escape sequence may take to arrive
+#define FRAME_RATE 60      // frames a second at most, :fps changes it
+#define FRAME_LAG_MS 100   // longest a stream of keys holds back a frame
+#define FRAME_STALL_MS 1000  // longest a frame waits for the terminal to show the last one
+#define FRAME_SYNC_TRIES 3    // frames sent without any answer before the terminal is not asked again
+#define VIEW_MIN_BYTES (1LL<<28)  // files this large open in the viewer
+#define VIEW_ROWS (1<<16)   // rows the viewer keeps before it drops those far from the cursor
+#define VIEW_MARGIN 1024    // rows the viewer adds in front of its window at once
+#define VIEW_POLL_MS 100    // how often the status bar follows the index while it is built
 
 int LOGO[] = {
     22, 6, -1, 
@@ -61,7 +102,8 @@ enum editorKey {
   END_KEY,
   PAGE_UP,
   PAGE_DOWN,
-  ESCAPE
+  ESCAPE,
+  PASTE         // a bracketed paste, its text is in Paste
 };
 
 #define FOREACH_MODE(MODE) \
@@ -81,22 +123,24 @@ static const char *MODES_STRING[] = {
     FOREACH_MODE(GENERATE_STRING)
 };
 
-typedef struct {
-  int idx;
-  int size;
-  int render_size;
-  char *chars;
-  char *render;
-  unsigned char *hl;
-  int hl_open_comment;
-} erow;
-
-
 struct editorSyntax {
   char *filetype;
   int flags;
 };
 
+/* rows from `from` on may still carry a stale comment state. the walk
+   that fixes them may only stop once it is past `until` */
+struct hlPending {
+  int from;
+  int until;
+  int batch;  // rows the worker takes on in its next step of this walk
+};
+
+struct markList {
+  int *v;  // render column and lexer state of each mark
+  int n, cap;
+};
+
 struct editorConfig{
   int cursor_x, cursor_y;
   int render_position_x;
@@ -104,10 +148,37 @@ struct editorConfig{
   int col_offset;
   int row_offset;
   int numrows;
-  erow *row;
+  struct rowTree rows;
+  struct slab slab;  // text, render and hl of the rows
+  int rendered;      // rows that have a render
+  int *render_rows;  // where rows were when they got one, eviction starts there
+  int render_nrows, render_cap;
+  unsigned int frame;
   int dirty;
   char editorMode;
   char *filename;
+  char *map;
+  size_t map_size;
+  size_t map_offset;
+  size_t map_len;    // bytes mapped, map_size drops below it when the file turns out cut short
+  int map_fd;        // the mapped file, kept open to see how much of it is left
+  long long eol_lf, eol_crlf;  // line ends seen while loading
+  struct hlPending hl_pending[HL_PENDING_MAX];
+  int hl_npending;
+  int hl_frontier;
+  unsigned int hl_epoch;
+  struct undoLog undo;
+  int undo_paused;  // edits are not recorded while set
+  struct searchPattern search;
+  int search_y, search_x;  // where the search started
+  int match_row;           // row whose hl shows the current match, -1 for none
+  size_t search_at;        // where the row the search started from starts, in the viewer
+  int viewer;              // read-only window onto the mapping, see editorView
+  size_t view_offset;      // where the first row of the window starts
+  long long view_line;     // the line that is, -1 until the index gets there
+  long long view_shift;    // rows the window has moved down the file by
+  long long view_goto;     // a line the index has not reached yet, -1 for none
+  long long view_count;    // lines the status bar shows
   char command_buf[16];
   char statusmsg[80];
   time_t statusmsg_time;
@@ -119,46 +190,113 @@ struct editorConfig{
 
 /*  prototypes  */
 void editorSetStatusMessage(const char *fmt, ...);
+int editorFrameSchedule();
+void editorFrameShown();
+long long editorNow();
 void editorReadCommand(const char *fmt, ...);
 int editorReadKey();
 void editorFree();
 void initEditor();
 void editorRefreshScreen();
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
+void editorUndoRecord(int type, int row, int col, char *s, int len);
+int editorReadOnly();
+int editorViewReach(size_t offset, long long line);
+void editorViewAt(size_t offset, long long line);
 
 
-/* append buffer */
-struct abuf {
-  char* b;
-  int len;
-};
+/*  row operations  */
 
-#define ABUF_INIT {NULL, 0};
+/* where what a row keeps after its render or hl starts */
+size_t editorRowTailAt(int render_size){
+  return (render_size + sizeof(int)) & ~(sizeof(int) - 1);
+}
 
-void abAppend(struct abuf *ab, const char *s, int len){
-  char *new = realloc(ab->b, ab->len + len);
+/* a row with tabs keeps an index of them after its render: the count,
+   then for every tab its column and the render column just past it */
+int *editorRowTabs(erow *row){
+  return (int *)&row->render[editorRowTailAt(row->render_size)];
+}
 
-  if (new == NULL) return;
-  memcpy(&new[ab->len], s, len);
-  ab->b = new;
-  ab->len += len;
+/* a long row keeps the marks of its lexing after its hl: the count, then
+   for each the render column of a token start and the lexer state there */
+int *editorRowMarks(erow *row){
+  return (int *)&row->hl[editorRowTailAt(row->render_size)];
+}
+
+/* tabs of chars expanded the way editorRenderRow does into out, which may be NULL.
+   returns the length that takes */
+int editorExpandTabs(char *chars, int size, char *out){
+  int idx = 0;
+  for (int j = 0; j < size; j++){
+    if (chars[j] == '\t'){
+      do {
+        if (out) out[idx] = ' ';
+        idx++;
+      } while (idx % TAB_STOP != 0);
+    } else {
+      if (out) out[idx] = chars[j];
+      idx++;
+    }
+  }
+  return idx;
 }
 
-void abFree(struct abuf *ab){
-  free(ab->b);
+struct {
+  char *s;
+  int cap;
+} Expanded;  // the text of a row with tabs and no render yet, for editorRowText
+
+/* the text a row is lexed from: its render, built or not, so the comment
+   state a row ends in does not depend on whether it was ever shown */
+char *editorRowText(erow *row, int *len){
+  if (row->render != NULL){
+    *len = row->render_size;
+    return row->render;
+  }
+  if (memchr(row->chars, '\t', row->size) == NULL){
+    *len = row->size;
+    return row->chars;
+  }
+
+  *len = editorExpandTabs(row->chars, row->size, NULL);
+  if (*len > Expanded.cap){
+    Expanded.cap = *len;
+    Expanded.s = realloc(Expanded.s, Expanded.cap);
+    if (Expanded.s == NULL) die("realloc");
+  }
+  editorExpandTabs(row->chars, row->size, Expanded.s);
+  return Expanded.s;
 }
 
-/*  row operations  */
+/* the last tab before column cx, -1 for none */
+int editorRowTabBefore(int *tabs, int cx){
+  int lo = 0, hi = tabs[0];
+  while (lo < hi){
+    int mid = (lo + hi) / 2;
+    if (tabs[1 + 2*mid] < cx) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo - 1;
+}
 
 int editorRowCxToRx(erow *row, int cx){
   int rx = 0;
 
-  int j;
-  for (j = 0; j < cx; j++) {
-    if (row->chars[j] == '\t'){
-      rx += (TAB_STOP - 1) - (rx % TAB_STOP);
+  if (row->flags & ROW_RENDER_ALIAS){
+    rx = cx;
+  } else if (row->render != NULL){
+    int *tabs = editorRowTabs(row);
+    int k = editorRowTabBefore(tabs, cx);
+    rx = k < 0 ? cx : tabs[2 + 2*k] + cx - tabs[1 + 2*k] - 1;
+  } else {
+    int j;
+    for (j = 0; j < cx; j++) {
+      if (row->chars[j] == '\t'){
+        rx += (TAB_STOP - 1) - (rx % TAB_STOP);
+      }
+      rx++;
     }
-    rx++;
   }
   
   // line number
@@ -167,227 +305,1850 @@ int editorRowCxToRx(erow *row, int cx){
   return rx;
 } 
 
+/* the column under render column rx, the inverse of editorRowCxToRx */
 int editorRowRxToCx(erow *row, int rx){
-  int cur_rx = 0;
   int cx;
-  for (cx = 0; cx < row->size; cx++){
-    if (row->chars[cx] == '\t'){
-      cur_rx += (TAB_STOP - 1) - (cur_rx % TAB_STOP);
+
+  rx -= LEFT_PADDING;
+  if (row->flags & ROW_RENDER_ALIAS){
+    cx = rx;
+  } else if (row->render != NULL){
+    int *tabs = editorRowTabs(row);
+    int lo = 0, hi = tabs[0];
+    while (lo < hi){
+      int mid = (lo + hi) / 2;
+      if (tabs[2 + 2*mid] <= rx) lo = mid + 1;
+      else hi = mid;
+    }
+    // lo is the first tab ending past rx, the row is plain text up to its start
+    int cx0 = lo ? tabs[1 + 2*(lo-1)] + 1 : 0;
+    int rx0 = lo ? tabs[2 + 2*(lo-1)] : 0;
+    cx = cx0 + rx - rx0;
+    if (lo < tabs[0] && cx > tabs[1 + 2*lo]) cx = tabs[1 + 2*lo];
+  } else {
+    int cur_rx = 0;
+    for (cx = 0; cx < row->size; cx++){
+      if (row->chars[cx] == '\t'){
+        cur_rx += (TAB_STOP - 1) - (cur_rx % TAB_STOP);
+      }
+      cur_rx++;
+      if (cur_rx > rx) return cx;
     }
-    cur_rx++;
-    if (cur_rx > rx) return cx;
   }
-  cx -= LEFT_PADDING;
+  if (cx < 0) cx = 0;
+  if (cx > row->size) cx = row->size;
   return cx;
 }
 
-void editorUpdateSyntax(erow *erow){
-  int token_type = 0, pos = 0, token_len = 0;
-
-  erow->hl = realloc(erow->hl, erow->render_size);
-  memset(erow->hl, PLAIN, erow->render_size);
+erow *editorRowAt(int at){
+  return rowsAt(&Editor.rows, at);
+}
 
-  if (lexerGetSyntaxName() == NULL) return; 
+int editorNumRows(){
+  return Editor.numrows;
+}
 
-  lexerSetInput(erow->render, erow->render_size);
+void editorSetCursor(int y, int x){
+  Editor.cursor_y = y;
+  Editor.cursor_x = x;
+}
 
+/* lexes one line starting in the given comment state, fills hl when it is not NULL
+   and returns the comment state at the end of the line */
+int editorHighlight(char *s, int len, unsigned char *hl, int open_comment){
+  int token_type = 0, pos = 0, token_len = 0;
 
-  if (&erow->idx > 0){
-    erow->hl_open_comment = Editor.row[erow->idx-1].hl_open_comment;
-  } else {
-    erow->hl_open_comment = 0;
-  }
+  if (lexerGetSyntaxName() == NULL) return open_comment;
+  if (lexerSetInput(s, len) == -1) return open_comment;
 
   while (token_type != EOF){
     pos = lexerGetPos();
 
-    if (pos >= erow->render_size) return;
+    if (pos >= len) break;
     token_type = lexerGetNextToken(&token_len);
 
-	 if (token_type == COMMENT){
-       memset(&erow->hl[pos], COMMENT, erow->render_size - pos);
-       return;
- 	 }
+    if (token_type == COMMENT){
+      if (hl) memset(&hl[pos], COMMENT, len - pos);
+      break;
+    }
 
     if (token_type == MCOM_END){
-      erow->hl_open_comment = 0;
+      open_comment = 0;
     }
 
-    
     if (token_type == MCOM_START){
-      erow->hl_open_comment = 1;
+      open_comment = 1;
+    }
+
+    if (hl == NULL) continue;
+    if (open_comment == 1){
+      memset(&hl[pos], COMMENT, len - pos);
+    } else {
+      memset(&hl[pos], token_type, token_len);
+    }
+  }
+
+  return open_comment;
+}
+
+void editorMarkPush(struct markList *l, int pos, int state){
+  if (l->n == l->cap){
+    l->cap = l->cap ? l->cap * 2 : 64;
+    l->v = realloc(l->v, sizeof(int) * 2 * l->cap);
+    if (l->v == NULL) die("realloc");
+  }
+  l->v[2*l->n] = pos;
+  l->v[2*l->n + 1] = state;
+  l->n++;
+}
+
+/*
+  Lexes the render of a row from column from on into its hl, writing what
+  editorHighlight would. from has to be a mark, or 0 for the start of the
+  row, and *state the lexer state there: the open comment, plus 2 once the
+  rest of the row was filled as comment, which is what bytes between tokens
+  are left with.
+
+  Marks go to out about every HL_MARK_SPAN bytes. A mark is a token start
+  that no scan for an earlier token read more than the lookahead past, so
+  a change from there on leaves everything before the mark as it was.
+
+  With the old marks of the row given, shifted by shift, it stops at the
+  first token start from sync on that is one of them in the same state:
+  the row reads the same from there on and so lexes the same. The old
+  marks from there on go to out and it returns 1. Otherwise it returns 0
+  with *state the state at the end.
+*/
+int editorLexSpan(erow *row, int from, int *state, struct markList *out,
+                  int sync, int *old, int nold, int shift){
+  char *s = row->render;
+  unsigned char *hl = row->hl;
+  int len = row->render_size;
+  int open = *state & 1, fill = *state & 2 ? COMMENT : PLAIN;
+  int done = from, last = from, reach = from, k = 0;
+  int look = lexerGetLookahead();
+
+  if (from < len) lexerSetInput(&s[from], len - from);
+  while (from < len){
+    int pos = from + lexerGetPos(), token_len;
+    if (pos >= len) break;
+
+    int at = open | (fill == COMMENT) << 1;
+    if (old != NULL && pos >= sync){
+      while (k < nold && old[2*k] + shift < pos) k++;
+      if (k < nold && old[2*k] + shift == pos && old[2*k + 1] == at){
+        memset(&hl[done], fill, pos - done);
+        for (; k < nold; k++){
+          if (old[2*k] + shift + look >= reach) editorMarkPush(out, old[2*k] + shift, old[2*k + 1]);
+        }
+        return 1;
+      }
+    }
+    if (pos - last >= HL_MARK_SPAN && reach <= pos + look){
+      editorMarkPush(out, pos, at);
+      last = pos;
     }
 
-    if (erow->hl_open_comment == 1){
-      memset(&erow->hl[pos], COMMENT, erow->render_size - pos); 
+    int token_type = lexerGetNextToken(&token_len);
+    if (from + lexerGetReach() > reach) reach = from + lexerGetReach();
+    memset(&hl[done], fill, pos - done);
+    if (token_type == COMMENT){
+      memset(&hl[pos], COMMENT, len - pos);
+      done = len;
+      break;
+    }
+    if (token_type == MCOM_END) open = 0;
+    if (token_type == MCOM_START) open = 1;
+    if (open) fill = COMMENT;
+    memset(&hl[pos], open ? COMMENT : token_type, token_len);
+    done = pos + token_len;
+  }
+  memset(&hl[done], fill, len - done);
+
+  *state = open | (fill == COMMENT) << 1;
+  return 0;
+}
+
+struct markList Marks;  // built up by editorLexSpan before going after a row's hl
+struct markList OldMarks;  // a row's marks from before an edit, while editorRowPatch lexes over them
+
+void editorRowSetMarks(erow *row, struct markList *l){
+  row->hl = slabRealloc(&Editor.slab, row->hl, editorRowTailAt(row->render_size) + sizeof(int) * (1 + 2*l->n));
+  int *marks = editorRowMarks(row);
+  marks[0] = l->n;
+  if (l->n) memcpy(&marks[1], l->v, sizeof(int) * 2 * l->n);
+  row->flags |= ROW_HL_MARKS;
+}
+
+/* lexes a row from the given comment state, hl is only filled for rows that have a render.
+   long rows get marked for editorRowPatch on the way */
+int editorLexRow(erow *row, int entry){
+  int exit;
+  if (row->render != NULL && row->render_size >= HL_PATCH_MIN && lexerGetSyntaxName() != NULL){
+    row->hl = slabRealloc(&Editor.slab, row->hl, row->render_size);
+    Marks.n = 0;
+    exit = entry;
+    editorLexSpan(row, 0, &exit, &Marks, 0, NULL, 0, 0);
+    exit &= 1;
+    editorRowSetMarks(row, &Marks);
+  } else if (row->render != NULL){
+    row->hl = slabRealloc(&Editor.slab, row->hl, row->render_size);
+    memset(row->hl, PLAIN, row->render_size);
+    exit = editorHighlight(row->render, row->render_size, row->hl, entry);
+    row->flags &= ~ROW_HL_MARKS;
+  } else {
+    int len;
+    char *text = editorRowText(row, &len);
+    exit = editorHighlight(text, len, NULL, entry);
+  }
+
+  if (!(row->flags & ROW_HL_VALID) || row->hl_entry != entry || row->hl_open_comment != exit){
+    Editor.hl_epoch++;
+  }
+  row->hl_entry = entry;
+  row->hl_open_comment = exit;
+  row->flags |= ROW_HL_VALID;
+  return exit;
+}
+
+/* comment state a row starts in. rows above that were never lexed are lexed on
+   the way, unless that takes more than HL_SYNC_ROWS rows: then it returns -1
+   and leaves them to the worker */
+int editorRowEntryState(int filerow){
+  int from = filerow - 1;
+  erow *row = NULL;
+
+  while (from >= 0){
+    row = editorRowAt(from);
+    if (row->flags & ROW_HL_VALID) break;
+    if (filerow - from > HL_SYNC_ROWS) return -1;
+    from--;
+  }
+
+  int open_comment = from >= 0 ? row->hl_open_comment : 0;
+  for (int j = from + 1; j < filerow; j++){
+    open_comment = editorLexRow(editorRowAt(j), open_comment);
+  }
+
+  return open_comment;
+}
+
+/* re-lexes rows from filerow on while their entry state is stale. returns the
+   row it had to stop at because of limit, or -1 once the states line up again */
+int editorSyntaxWalk(int filerow, int until, int limit){
+  if (filerow >= Editor.numrows) return -1;
+
+  int entry = 0;
+  if (filerow > 0){
+    erow *prev = editorRowAt(filerow - 1);
+    if (!(prev->flags & ROW_HL_VALID)) return -1;
+    entry = prev->hl_open_comment;
+  }
+
+  struct rowIter it;
+  erow *row;
+  rowsIterAt(&Editor.rows, &it, filerow);
+  for (int j = filerow; (row = rowsIterNext(&it)) != NULL; j++){
+    if (!(row->flags & ROW_HL_VALID)) return -1;
+    if (row->hl_entry == entry && j > until) return -1;
+    if (j >= limit) return j;
+    entry = editorLexRow(row, entry);
+  }
+  return -1;
+}
+
+void editorSyntaxAddPending(int from, int until){
+  int i = 0;
+  Editor.hl_epoch++;
+  while (i < Editor.hl_npending && Editor.hl_pending[i].from < from) i++;
+
+  if (i < Editor.hl_npending && Editor.hl_pending[i].from == from){
+    if (until > Editor.hl_pending[i].until) Editor.hl_pending[i].until = until;
+    return;
+  }
+
+  if (Editor.hl_npending == HL_PENDING_MAX){
+    // out of slots: one walk from the first pending row that does not stop before the last
+    int last = Editor.hl_pending[HL_PENDING_MAX - 1].until;
+    for (int j = 0; j < HL_PENDING_MAX; j++){
+      if (Editor.hl_pending[j].until > last) last = Editor.hl_pending[j].until;
+    }
+    Editor.hl_pending[0].from = from < Editor.hl_pending[0].from ? from : Editor.hl_pending[0].from;
+    Editor.hl_pending[0].until = until > last ? until : last;
+    Editor.hl_pending[0].batch = HL_SYNC_ROWS;
+    Editor.hl_npending = 1;
+    return;
+  }
+
+  memmove(&Editor.hl_pending[i + 1], &Editor.hl_pending[i],
+          sizeof(struct hlPending) * (Editor.hl_npending - i));
+  Editor.hl_pending[i].from = from;
+  Editor.hl_pending[i].until = until;
+  Editor.hl_pending[i].batch = HL_SYNC_ROWS;
+  Editor.hl_npending++;
+}
+
+void editorSyntaxDropPending(int i){
+  memmove(&Editor.hl_pending[i], &Editor.hl_pending[i + 1],
+          sizeof(struct hlPending) * (Editor.hl_npending - i - 1));
+  Editor.hl_npending--;
+}
+
+/* the entry state of filerow may have changed: fix the rows on screen now, the rest later */
+void editorSyntaxDamage(int filerow){
+  int stop = editorSyntaxWalk(filerow, filerow - 1, Editor.row_offset + Editor.screen_rows);
+  if (stop != -1) editorSyntaxAddPending(stop, stop);
+}
+
+/* continues the pending walks that are at most HL_SYNC_ROWS short of row limit,
+   longer ones are left to the worker */
+void editorSyntaxCatchUp(int limit){
+  int i = 0;
+  while (i < Editor.hl_npending && Editor.hl_pending[i].from < limit){
+    struct hlPending *p = &Editor.hl_pending[i];
+    int stop_at = limit;
+    if (i + 1 < Editor.hl_npending && Editor.hl_pending[i + 1].from < stop_at){
+      stop_at = Editor.hl_pending[i + 1].from;
+    }
+    if (stop_at - p->from > HL_SYNC_ROWS){
+      i++;
+      continue;
+    }
+
+    int stop = editorSyntaxWalk(p->from, p->until, stop_at);
+
+    if (stop != -1 && i + 1 < Editor.hl_npending && stop == Editor.hl_pending[i + 1].from){
+      // caught up with the next walk, it takes over
+      if (p->until > Editor.hl_pending[i + 1].until) Editor.hl_pending[i + 1].until = p->until;
+      stop = -1;
+    }
+
+    if (stop == -1){
+      editorSyntaxDropPending(i);
     } else {
-      memset(&erow->hl[pos], token_type, token_len);
+      p->from = stop;
+      i++;
     }
   }
+}
 
-  return;
+/* keeps row numbers in the pending walks in place when rows come and go */
+void editorSyntaxShift(int at, int delta){
+  Editor.hl_epoch++;
+  for (int i = 0; i < Editor.hl_npending; i++){
+    struct hlPending *p = &Editor.hl_pending[i];
+    if (p->from > at || (delta > 0 && p->from == at)) p->from += delta;
+    if (p->until > at || (delta > 0 && p->until == at)) p->until += delta;
+  }
+  if (Editor.hl_frontier > at) Editor.hl_frontier += delta;
 }
 
+/*  background highlighting  */
+
+/*
+  The worker thread lexes batches of rows the main thread copied out for
+  it, so it never touches the rows themselves. The job slot changes hands
+  through its state alone: the main thread fills a free slot and queues
+  it, the worker marks it done. Every change to rows or their comment
+  state bumps Editor.hl_epoch, results lexed at an older epoch are thrown
+  away. Rows the worker has not reached yet are drawn plain.
+
+  A large job is cut into chunks the worker shares with helper threads,
+  one chunk per core. Only the first chunk knows its entry state, every
+  other one is lexed as if it started outside a comment and, row by row,
+  again as if inside one until both runs agree on a row's exit. Once the
+  chunks are done the worker walks them in order and takes the second run
+  where a chunk turns out to start inside a comment.
+*/
+
+enum hlJobState {
+  HL_JOB_FREE,
+  HL_JOB_QUEUED,
+  HL_JOB_DONE
+};
+
+struct hlChunk {
+  int first, last;        // rows of the job
+  int merge;              // first row both runs agree on from here on
+};
 
-void editorUpdateRow(erow *row){
-  int tabs = 0;
+struct hlJob {
+  int state;
+  unsigned int epoch;
+  int walk;               // continues the pending walk starting at from
+  int from, until, count;
+  int entry;
+  void *syntax;
+  char *text;             // the rows back to back
+  unsigned char *hl;      // filled for the rows in want
+  unsigned char *hl_alt;  // the run inside a comment, up to each chunk's merge row
+  size_t text_cap;
+  int *offsets;           // count + 1 offsets into text
+  unsigned char *want;
+  unsigned char *exits;   // comment state at the end of every row
+  unsigned char *exits_alt;
+  int rows_cap;
+  struct hlChunk chunks[HL_THREADS_MAX];
+  int nchunks;
+  int next;               // the next chunk a thread takes
+};
+
+struct hlWorker {
+  pthread_t thread;
+  int started;            // 1 running, -1 could not start, jobs then run inline
+  sem_t wake;
+  int done[2];            // the worker writes a byte here for every finished job
+  int nthreads;           // threads lexing a job, the worker included
+  pthread_t helpers[HL_THREADS_MAX];
+  sem_t go, finished;     // a helper takes chunks on go and posts finished when none are left
+  struct hlJob job;
+} HlWorker;
+
+/* lexes one chunk of the job, see above */
+void editorHighlightChunk(struct hlJob *job, int c){
+  struct hlChunk *chunk = &job->chunks[c];
+  int entry = c == 0 ? job->entry : 0, alt = 1;
+
+  lexerUseSyntax(job->syntax);
+  chunk->merge = c == 0 ? chunk->first : chunk->last;
+  for (int k = chunk->first; k < chunk->last; k++){
+    char *s = &job->text[job->offsets[k]];
+    int len = job->offsets[k + 1] - job->offsets[k];
+    unsigned char *hl = NULL;
+    if (job->want[k]){
+      hl = &job->hl[job->offsets[k]];
+      memset(hl, PLAIN, len);
+    }
+    entry = editorHighlight(s, len, hl, entry);
+    job->exits[k] = entry;
+
+    if (k >= chunk->merge) continue;
+    hl = NULL;
+    if (job->want[k]){
+      hl = &job->hl_alt[job->offsets[k]];
+      memset(hl, PLAIN, len);
+    }
+    alt = editorHighlight(s, len, hl, alt);
+    job->exits_alt[k] = alt;
+    if (alt == entry) chunk->merge = k + 1;
+  }
+}
+
+void editorHighlightChunks(struct hlJob *job){
+  int c;
+  while ((c = __atomic_fetch_add(&job->next, 1, __ATOMIC_ACQ_REL)) < job->nchunks){
+    editorHighlightChunk(job, c);
+  }
+}
+
+void editorHighlightJob(struct hlJob *job){
+  int total = job->offsets[job->count];
+  int n = total / HL_CHUNK_BYTES, k = 0;
+
+  if (n > HlWorker.nthreads) n = HlWorker.nthreads;
+  if (n < 1) n = 1;
+
+  // even shares of the text, a row longer than a share leaves the next chunk out
+  job->nchunks = 0;
+  for (int c = 0; c < n; c++){
+    long long end = (long long)total * (c + 1) / n;
+    int first = k;
+    while (k < job->count && (c == n - 1 || job->offsets[k] < end)) k++;
+    if (k == first) continue;
+    job->chunks[job->nchunks].first = first;
+    job->chunks[job->nchunks].last = k;
+    job->nchunks++;
+  }
+
+  job->next = 0;
+  for (int i = 1; i < job->nchunks; i++) sem_post(&HlWorker.go);
+  editorHighlightChunks(job);
+  for (int i = 1; i < job->nchunks; i++){
+    while (sem_wait(&HlWorker.finished) == -1);
+  }
+
+  // stitch: a chunk entered inside a comment takes the second run up to its merge row
+  int entry = job->entry;
+  for (int c = 0; c < job->nchunks; c++){
+    struct hlChunk *chunk = &job->chunks[c];
+    if (c > 0 && entry == 1){
+      int a = job->offsets[chunk->first], b = job->offsets[chunk->merge];
+      memcpy(&job->hl[a], &job->hl_alt[a], b - a);
+      memcpy(&job->exits[chunk->first], &job->exits_alt[chunk->first], chunk->merge - chunk->first);
+    }
+    entry = job->exits[chunk->last - 1];
+  }
+}
+
+void *editorHighlightHelper(void *arg){
+  struct hlJob *job = arg;
+
+  while (1){
+    if (sem_wait(&HlWorker.go) == -1) continue;
+    editorHighlightChunks(job);
+    sem_post(&HlWorker.finished);
+  }
+  return NULL;
+}
+
+void *editorHighlightWorker(void *arg){
+  struct hlJob *job = arg;
+
+  while (1){
+    if (sem_wait(&HlWorker.wake) == -1) continue;
+    if (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != HL_JOB_QUEUED) continue;
+    editorHighlightJob(job);
+    __atomic_store_n(&job->state, HL_JOB_DONE, __ATOMIC_RELEASE);
+    write(HlWorker.done[1], "", 1);
+  }
+  return NULL;
+}
+
+/* starts the worker and as many helpers as there are other cores, jobs run inline when it fails */
+void editorSyntaxStart(){
+  struct hlJob *job = &HlWorker.job;
+
+  HlWorker.started = -1;
+  HlWorker.nthreads = 1;
+  if (sem_init(&HlWorker.wake, 0, 0) != 0 || pipe(HlWorker.done) != 0 ||
+      fcntl(HlWorker.done[0], F_SETFL, O_NONBLOCK) != 0 || fcntl(HlWorker.done[1], F_SETFL, O_NONBLOCK) != 0 ||
+      pthread_create(&HlWorker.thread, NULL, editorHighlightWorker, job) != 0){
+    return;
+  }
+  HlWorker.started = 1;
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores > HL_THREADS_MAX) cores = HL_THREADS_MAX;
+  if (cores < 2 || sem_init(&HlWorker.go, 0, 0) != 0 || sem_init(&HlWorker.finished, 0, 0) != 0) return;
+  while (HlWorker.nthreads < cores &&
+         pthread_create(&HlWorker.helpers[HlWorker.nthreads - 1], NULL, editorHighlightHelper, job) == 0){
+    HlWorker.nthreads++;
+  }
+}
+
+/* first row past the prefix of rows that know their comment state */
+int editorSyntaxFrontier(){
+  int f = Editor.hl_frontier;
+  if (f > Editor.numrows) f = Editor.numrows;
+  if (f < 0) f = 0;
+
+  while (f > 0 && !(editorRowAt(f - 1)->flags & ROW_HL_VALID)) f--;
+
+  struct rowIter it;
+  erow *row;
+  rowsIterAt(&Editor.rows, &it, f);
+  while ((row = rowsIterNext(&it)) != NULL && (row->flags & ROW_HL_VALID)) f++;
+
+  Editor.hl_frontier = f;
+  return f;
+}
+
+/* copies up to rows rows from `from` on into the job, stopping early after HL_BATCH_BYTES a thread */
+void editorSyntaxFillJob(struct hlJob *job, int from, int rows){
+  struct rowIter it;
+  erow *row;
+  size_t len = 0;
+  int k = 0;
+
+  rowsIterAt(&Editor.rows, &it, from);
+  while (k < rows && len < (size_t)HL_BATCH_BYTES * HlWorker.nthreads && (row = rowsIterNext(&it)) != NULL){
+    int n;
+    char *s = editorRowText(row, &n);
+
+    if (k + 2 > job->rows_cap){
+      job->rows_cap = job->rows_cap ? job->rows_cap * 2 : 1024;
+      job->offsets = realloc(job->offsets, sizeof(int) * job->rows_cap);
+      job->want = realloc(job->want, job->rows_cap);
+      job->exits = realloc(job->exits, job->rows_cap);
+      job->exits_alt = realloc(job->exits_alt, job->rows_cap);
+      if (!job->offsets || !job->want || !job->exits || !job->exits_alt) die("realloc");
+    }
+    if (len + n > job->text_cap){
+      job->text_cap = job->text_cap ? job->text_cap : 1 << 16;
+      while (job->text_cap < len + n) job->text_cap *= 2;
+      job->text = realloc(job->text, job->text_cap);
+      job->hl = realloc(job->hl, job->text_cap);
+      if (!job->text || !job->hl) die("realloc");
+      if (HlWorker.nthreads > 1){
+        job->hl_alt = realloc(job->hl_alt, job->text_cap);
+        if (!job->hl_alt) die("realloc");
+      }
+    }
+
+    memcpy(&job->text[len], s, n);
+    job->offsets[k] = len;
+    job->want[k] = row->render != NULL;
+    len += n;
+    k++;
+  }
+  job->offsets[k] = len;
+  job->count = k;
+}
+
+/* hands the next piece of work to the worker: pending walks first, then the rows past the frontier */
+void editorSyntaxSubmit(){
+  struct hlJob *job = &HlWorker.job;
+  int from, rows;
+
+  if (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != HL_JOB_FREE) return;
+  if (lexerGetSyntaxName() == NULL) return;
+
+  while (Editor.hl_npending){
+    from = Editor.hl_pending[0].from;
+    if (from < Editor.numrows && (from == 0 || (editorRowAt(from - 1)->flags & ROW_HL_VALID))) break;
+    editorSyntaxDropPending(0);
+  }
+
+  if (Editor.hl_npending){
+    job->walk = 1;
+    job->until = Editor.hl_pending[0].until;
+    rows = Editor.hl_pending[0].batch;
+  } else {
+    from = editorSyntaxFrontier();
+    if (from >= Editor.numrows) return;
+    job->walk = 0;
+    job->until = 0;
+    rows = Editor.numrows;
+  }
+
+  job->epoch = Editor.hl_epoch;
+  job->from = from;
+  job->entry = from > 0 ? editorRowAt(from - 1)->hl_open_comment : 0;
+  job->syntax = lexerGetSyntax();
+  if (HlWorker.started == 0) editorSyntaxStart();
+  editorSyntaxFillJob(job, from, rows);
+
+  if (HlWorker.started == 1){
+    __atomic_store_n(&job->state, HL_JOB_QUEUED, __ATOMIC_RELEASE);
+    sem_post(&HlWorker.wake);
+  } else {
+    editorHighlightJob(job);
+    job->state = HL_JOB_DONE;
+  }
+}
+
+/* takes over the states the worker computed, returns 1 when a row on screen changed */
+int editorSyntaxApply(){
+  struct hlJob *job = &HlWorker.job;
+
+  if (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != HL_JOB_DONE) return 0;
+  job->state = HL_JOB_FREE;
+  if (job->epoch != Editor.hl_epoch) return 0;
+
+  int p = -1;
+  if (job->walk){
+    for (int i = 0; i < Editor.hl_npending; i++){
+      if (Editor.hl_pending[i].from == job->from) p = i;
+    }
+    if (p == -1) return 0;
+  }
+
+  struct rowIter it;
+  erow *row;
+  int entry = job->entry, converged = 0, j = job->from, k;
+  rowsIterAt(&Editor.rows, &it, job->from);
+  for (k = 0; k < job->count && (row = rowsIterNext(&it)) != NULL; k++, j++){
+    if (job->walk){
+      if (!(row->flags & ROW_HL_VALID) || (row->hl_entry == entry && j > job->until)){
+        converged = 1;
+        break;
+      }
+    }
+
+    int len = job->offsets[k + 1] - job->offsets[k];
+    if (row->render != NULL && job->want[k] && len == row->render_size){
+      row->hl = slabRealloc(&Editor.slab, row->hl, len);
+      memcpy(row->hl, &job->hl[job->offsets[k]], len);
+      row->flags &= ~ROW_HL_MARKS;
+    } else if (row->render != NULL){
+      row->hl = slabRealloc(&Editor.slab, row->hl, row->render_size);
+      memset(row->hl, PLAIN, row->render_size);
+      editorHighlight(row->render, row->render_size, row->hl, entry);
+      row->flags &= ~ROW_HL_MARKS;
+    }
+    row->hl_entry = entry;
+    row->hl_open_comment = entry = job->exits[k];
+    row->flags |= ROW_HL_VALID;
+  }
+  Editor.hl_epoch++;
+
+  if (!job->walk){
+    Editor.hl_frontier = j;
+  } else if (converged || j >= Editor.numrows){
+    editorSyntaxDropPending(p);
+  } else {
+    struct hlPending *pending = &Editor.hl_pending[p];
+    pending->from = j;
+    if (pending->batch < INT_MAX / 2) pending->batch *= 2;
+    if (p + 1 < Editor.hl_npending && Editor.hl_pending[p + 1].from == j){
+      // caught up with the next walk, it takes over
+      if (pending->until > Editor.hl_pending[p + 1].until) Editor.hl_pending[p + 1].until = pending->until;
+      editorSyntaxDropPending(p);
+    }
+  }
+
+  return job->from < Editor.row_offset + Editor.screen_rows && j > Editor.row_offset;
+}
+
+/* collects finished work and queues more, returns 1 when the screen needs a redraw */
+int editorSyntaxIdle(){
+  int redraw = editorSyntaxApply();
+  editorSyntaxSubmit();
+  return redraw;
+}
+
+/* a job is done and waiting to be applied: always so for jobs run inline */
+int editorSyntaxReady(){
+  return __atomic_load_n(&HlWorker.job.state, __ATOMIC_ACQUIRE) == HL_JOB_DONE;
+}
+
+/* re-lexes a row whose text changed and carries a changed comment state down to the rows below.
+   a row too far past the frontier is left plain for the worker */
+void editorUpdateSyntax(int filerow){
+  erow *row = editorRowAt(filerow);
+  int entry = editorRowEntryState(filerow);
+
+  if (entry == -1){
+    if (row->render != NULL){
+      row->hl = slabRealloc(&Editor.slab, row->hl, row->render_size);
+      memset(row->hl, PLAIN, row->render_size);
+      row->flags &= ~ROW_HL_MARKS;
+    }
+    return;
+  }
+
+  editorLexRow(row, entry);
+  editorSyntaxDamage(filerow + 1);
+}
+
+/* the syntax changed: every row forgets its state and is lexed again when it is needed */
+void editorUpdateAllSyntax(){
+  struct rowIter it;
+  erow *row;
+  rowsIterAt(&Editor.rows, &it, 0);
+  while ((row = rowsIterNext(&it)) != NULL){
+    row->flags &= ~ROW_HL_VALID;
+  }
+  Editor.hl_npending = 0;
+  Editor.hl_frontier = 0;
+  Editor.hl_epoch++;
+}
+
+/* notes the row of a new render for editorRenderEvict */
+void editorRenderNote(int filerow){
+  if (Editor.render_nrows == Editor.render_cap){
+    Editor.render_cap = Editor.render_cap ? Editor.render_cap * 2 : RENDER_CACHE_ROWS;
+    Editor.render_rows = realloc(Editor.render_rows, sizeof(int) * Editor.render_cap);
+    if (Editor.render_rows == NULL) die("realloc");
+  }
+  Editor.render_rows[Editor.render_nrows++] = filerow;
+}
+
+/* expands tabs into the render of a row and indexes them, its hl is left
+   to the caller. a row without tabs renders as its own text */
+void editorRenderRow(erow *row, int filerow){
+  int tabs = 0, size = 0;
   int j;
   for (j = 0; j < row->size; j++){
-    if (row->chars[j] == '\t') tabs++;
+    if (row->chars[j] == '\t'){
+      size += TAB_STOP - size % TAB_STOP;
+      tabs++;
+    } else {
+      size++;
+    }
   }
-  free(row->render);
-  row->render = malloc(row->size + tabs*(TAB_STOP-1) + 1);
 
+  if (row->render == NULL){
+    Editor.rendered++;
+    editorRenderNote(filerow);
+  }
+  row->used = Editor.frame;
+
+  if (tabs == 0){
+    if (!(row->flags & ROW_RENDER_ALIAS)) slabFree(&Editor.slab, row->render);
+    row->render = row->chars;
+    row->render_size = row->size;
+    row->flags |= ROW_RENDER_ALIAS;
+    return;
+  }
+  if (row->flags & ROW_RENDER_ALIAS){
+    row->render = NULL;
+    row->flags &= ~ROW_RENDER_ALIAS;
+  }
+  row->render_size = size;
+  row->render = slabRealloc(&Editor.slab, row->render,
+                            editorRowTailAt(size) + sizeof(int) * (1 + 2*tabs));
+
+  int *index = editorRowTabs(row);
   int idx = 0;
+  index[0] = tabs;
+  index++;
   for (j = 0; j < row->size; j++){
     if (row->chars[j] == '\t'){
       row->render[idx++] = ' ';
       while (idx % TAB_STOP != 0) row->render[idx++] = ' ';
+      *index++ = j;
+      *index++ = idx;
     }else{
       row->render[idx++] = row->chars[j];
     }
   }
 
   row->render[idx] = '\0';
-  row->render_size = idx;
+}
 
-  editorUpdateSyntax(row);
+/* makes sure a row about to be shown has its render and hl */
+/* lexes a row again from the state it was lexed from last, the rows below follow when its exit changes */
+void editorRelexRow(erow *row, int filerow){
+  int exit = row->hl_open_comment;
+  if (editorLexRow(row, row->hl_entry) != exit) editorSyntaxDamage(filerow + 1);
 }
 
-void editorInsertRow(char *s, int at, size_t len) {
-  if (at < 0 || at > Editor.numrows) return; 
+erow *editorRowMaterialize(int filerow){
+  erow *row = editorRowAt(filerow);
+  row->used = Editor.frame;
+  if (row->render == NULL){
+    editorRenderRow(row, filerow);
+    if (row->flags & ROW_HL_VALID) editorRelexRow(row, filerow);
+    else editorUpdateSyntax(filerow);
+  } else if (!(row->flags & ROW_HL_VALID)){
+    editorUpdateSyntax(filerow);
+  }
+  return row;
+}
+
+void editorUpdateRow(int filerow){
+  editorRenderRow(editorRowAt(filerow), filerow);
+  Editor.hl_epoch++;
+  editorUpdateSyntax(filerow);
+}
+
+/* moves bytes [from, size) of a slab block to start at to, the block ends up bytes long */
+void *editorSpliceBlock(void *p, int size, int from, int to, size_t bytes){
+  if (to > from) p = slabRealloc(&Editor.slab, p, bytes);
+  memmove((char *)p + to, (char *)p + from, size - from);
+  if (to <= from) p = slabRealloc(&Editor.slab, p, bytes);
+  return p;
+}
+
+/*
+  A long row whose removed chars at column at were replaced by added ones
+  gets its render and hl patched around the edit. The render is expanded
+  again up to the first tab after the edit, past which tabs line up as
+  before, or just the edit when it moved the rest by whole tab stops. The
+  hl is lexed from the last mark far enough before the edit until the
+  tokens meet an old mark again. Rows it can't patch go to editorUpdateRow.
+*/
+void editorRowPatch(int filerow, int at, int removed, int added){
+  erow *row = editorRowAt(filerow);
+  int valid = ROW_HL_VALID | ROW_HL_MARKS;
+  if (row->render == NULL || row->render_size < HL_PATCH_MIN || (row->flags & valid) != valid ||
+      filerow == Editor.match_row || editorRowEntryState(filerow) != row->hl_entry){
+    editorUpdateRow(filerow);
+    return;
+  }
 
-  Editor.row = realloc(Editor.row, sizeof(erow) * (Editor.numrows + 1));
-  memmove(&Editor.row[at+1], &Editor.row[at], sizeof(erow) * (Editor.numrows - at));
+  int alias = row->flags & ROW_RENDER_ALIAS;
+  int *tabs = alias ? NULL : editorRowTabs(row);
+  int ntabs = alias ? 0 : tabs[0];
+  int k0 = ntabs ? editorRowTabBefore(tabs, at) + 1 : 0;            // first tab at or past the edit
+  int k1 = ntabs ? editorRowTabBefore(tabs, at + removed) + 1 : 0;  // first tab past it
+  int ra = editorRowCxToRx(row, at) - LEFT_PADDING;
+  int old_end = editorRowCxToRx(row, at + removed) - LEFT_PADDING;
+  int j;
 
-  for (int j = at + 1; j <= Editor.numrows; j++) Editor.row[j].idx++;
+  int new_end = ra, added_tabs = 0;
+  for (j = at; j < at + added; j++){
+    if (row->chars[j] == '\t'){
+      new_end += TAB_STOP - new_end % TAB_STOP;
+      added_tabs++;
+    } else {
+      new_end++;
+    }
+  }
 
-  Editor.row[at].idx = at;
+  // render [ra, rb_old) becomes chars [at, through) expanded into [ra, rb_new)
+  int rb_old = old_end, rb_new = new_end, through = at + added;
+  if ((new_end - old_end) % TAB_STOP != 0 && k1 < ntabs){
+    int x = new_end + tabs[1 + 2*k1] - (at + removed);
+    rb_old = tabs[2 + 2*k1];
+    rb_new = x + TAB_STOP - x % TAB_STOP;
+    through = tabs[1 + 2*k1] + added - removed + 1;
+  }
+  int old_size = row->render_size, shift = rb_new - rb_old;
+  int size = old_size + shift;
+  int ntabs_new = ntabs - (k1 - k0) + added_tabs;
+
+  if (ntabs_new == 0){
+    if (!alias) slabFree(&Editor.slab, row->render);
+    row->render = row->chars;
+    row->render_size = size;
+    row->flags |= ROW_RENDER_ALIAS;
+  } else {
+    size_t bytes = editorRowTailAt(size) + sizeof(int) * (1 + 2*ntabs_new);
+    if (alias){
+      // a row without tabs until now: the text around the edit is its render
+      row->render = slabAlloc(&Editor.slab, bytes);
+      memcpy(row->render, row->chars, ra);
+      memcpy(&row->render[rb_new], &row->chars[through], size - rb_new);
+      row->flags &= ~ROW_RENDER_ALIAS;
+    } else {
+      // the tabs before the edit and those after it move along with the text,
+      // each part goes first where it can't run over the other
+      char *r = row->render = slabRealloc(&Editor.slab, row->render, bytes);
+      int *old_ix = (int *)&r[editorRowTailAt(old_size)], *new_ix = (int *)&r[editorRowTailAt(size)];
+      int *after = &new_ix[1 + 2*(k0 + added_tabs)];
+      if (shift <= 0) memmove(&r[rb_new], &r[rb_old], old_size - rb_old);
+      if (new_ix <= old_ix) memmove(&new_ix[1], &old_ix[1], sizeof(int) * 2 * k0);
+      memmove(after, &old_ix[1 + 2*k1], sizeof(int) * 2 * (ntabs - k1));
+      if (new_ix > old_ix) memmove(&new_ix[1], &old_ix[1], sizeof(int) * 2 * k0);
+      if (shift > 0) memmove(&r[rb_new], &r[rb_old], old_size - rb_old);
+      for (int k = 0; k < ntabs - k1; k++){
+        after[2*k] += added - removed;
+        after[2*k + 1] += shift;
+      }
+    }
+    row->render_size = size;
+    int *index = editorRowTabs(row);
+    index[0] = ntabs_new;
+
+    int idx = ra, *added_tab = &index[1 + 2*k0];
+    for (j = at; j < through; j++){
+      if (row->chars[j] == '\t'){
+        row->render[idx++] = ' ';
+        while (idx % TAB_STOP != 0) row->render[idx++] = ' ';
+        if (j < at + added){
+          *added_tab++ = j;
+          *added_tab++ = idx;
+        }
+      } else {
+        row->render[idx++] = row->chars[j];
+      }
+    }
+    row->render[size] = '\0';
+  }
 
-  Editor.row[at].size = len;
-  Editor.row[at].chars = malloc(len + 1);
-  memcpy(Editor.row[at].chars, s, len);
-  Editor.row[at].chars[len] = '\0';
+  // the old marks, the hl goes over them
+  int *marks = (int *)&row->hl[editorRowTailAt(old_size)];
+  int nmarks = marks[0];
+  if (nmarks > OldMarks.cap){
+    OldMarks.cap = nmarks;
+    OldMarks.v = realloc(OldMarks.v, sizeof(int) * 2 * OldMarks.cap);
+    if (OldMarks.v == NULL) die("realloc");
+  }
+  int *old = OldMarks.v;
+  memcpy(old, &marks[1], sizeof(int) * 2 * nmarks);
+  row->hl = editorSpliceBlock(row->hl, old_size, rb_old, rb_new, size);
+
+  // lexing starts over from the last mark whose tokens could not have seen the edit
+  int look = lexerGetLookahead(), kb = 0, kr = 0;
+  while (kb < nmarks && old[2*kb] + look <= ra) kb++;
+  while (kr < nmarks && old[2*kr] < rb_old) kr++;
+  int from = kb ? old[2*(kb - 1)] : 0;
+  int state = kb ? old[2*(kb - 1) + 1] : row->hl_entry;
+
+  Marks.n = 0;
+  for (int k = 0; k < kb; k++) editorMarkPush(&Marks, old[2*k], old[2*k + 1]);
+  int met = editorLexSpan(row, from, &state, &Marks, rb_new, &old[2*kr], nmarks - kr, shift);
+  int exit = met ? row->hl_open_comment : state & 1;
+  editorRowSetMarks(row, &Marks);
+
+  row->used = Editor.frame;
+  row->hl_open_comment = exit;
+  Editor.hl_epoch++;
+  editorSyntaxDamage(filerow + 1);
+}
 
-  Editor.row[at].render_size = 0;
-  Editor.row[at].render = NULL;
-  Editor.row[at].hl = NULL;
-  Editor.row[at].hl_open_comment = 0;
-  editorUpdateRow(&Editor.row[at]);
+void editorInsertRow(char *s, int at, size_t len) {
+  if (at < 0 || at > Editor.numrows) return; 
 
+  erow *row = rowsInsert(&Editor.rows, at);
+  editorSyntaxShift(at, 1);
+
+  row->size = len;
+  row->chars = slabAlloc(&Editor.slab, len + 1);
+  memcpy(row->chars, s, len);
+  row->chars[len] = '\0';
+
+  row->render_size = 0;
+  row->render = NULL;
+  row->hl = NULL;
+  row->hl_entry = 0;
+  row->hl_open_comment = 0;
+  row->flags = 0;
+  // counted first, the rows below are walked when the new one changes their comment state
   Editor.numrows++;
+  editorUpdateRow(at);
+
   Editor.dirty++;
+  editorUndoRecord(UNDO_INSERT_ROW, at, 0, s, len);
+}
+
+/* drops the render and hl of a row, they are built again when it is shown */
+void editorRowEvict(erow *row){
+  if (row->render == NULL) return;
+  if (!(row->flags & ROW_RENDER_ALIAS)) slabFree(&Editor.slab, row->render);
+  slabFree(&Editor.slab, row->hl);
+  row->render = NULL;
+  row->hl = NULL;
+  row->render_size = 0;
+  row->flags &= ~(ROW_RENDER_ALIAS | ROW_HL_MARKS);
+  Editor.rendered--;
 }
 
 void editorFreeRow(erow *row){
-  free(row->render);
-  free(row->chars);
-  free(row->hl);
+  editorRowEvict(row);
+  if (!(row->flags & ROW_MAPPED)) slabFree(&Editor.slab, row->chars);
+  slabFree(&Editor.slab, row->hl);
+}
+
+int editorCompareUint(const void *a, const void *b){
+  unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+  return x < y ? -1 : x > y;
+}
+
+int editorCompareInt(const void *a, const void *b){
+  int x = *(const int *)a, y = *(const int *)b;
+  return x < y ? -1 : x > y;
+}
+
+int editorRenderKeep(int filerow){
+  return filerow == Editor.match_row ||
+         (filerow >= Editor.row_offset && filerow < Editor.row_offset + Editor.screen_rows);
+}
+
+/* the frame stamp at and below which renders go, to leave the newest half */
+unsigned int editorRenderCutoff(unsigned int *used, int n){
+  qsort(used, n, sizeof(unsigned int), editorCompareUint);
+  return used[n - RENDER_CACHE_ROWS / 2];
+}
+
+/*
+  Renders and hl only have to exist for the rows on screen. Once
+  RENDER_CACHE_ROWS of them were built, those drawn least recently are
+  dropped down to half that, never the ones on screen. The rows are found
+  through where they were rendered: rows shifted by edits since then are
+  missed, and when these add up to as many again the whole file is walked.
+*/
+void editorRenderEvict(){
+  if (Editor.render_nrows <= RENDER_CACHE_ROWS) return;
+
+  struct rowIter it;
+  erow *row;
+  unsigned int cutoff;
+  int *rows = Editor.render_rows;
+  int n = 0, j;
+
+  if (Editor.rendered > RENDER_CACHE_ROWS * 2){
+    unsigned int *used = malloc(sizeof(unsigned int) * Editor.rendered);
+    if (used == NULL) die("malloc");
+    rowsIterAt(&Editor.rows, &it, 0);
+    while ((row = rowsIterNext(&it)) != NULL && n < Editor.rendered){
+      if (row->render != NULL) used[n++] = row->used;
+    }
+    cutoff = editorRenderCutoff(used, n);
+    free(used);
+
+    Editor.render_nrows = 0;
+    rowsIterAt(&Editor.rows, &it, 0);
+    for (j = 0; (row = rowsIterNext(&it)) != NULL; j++){
+      if (row->render == NULL) continue;
+      if (row->used <= cutoff && !editorRenderKeep(j)) editorRowEvict(row);
+      else editorRenderNote(j);
+    }
+    return;
+  }
+
+  qsort(rows, Editor.render_nrows, sizeof(int), editorCompareInt);
+  for (int i = 0; i < Editor.render_nrows && rows[i] < Editor.numrows; i++){
+    if ((n == 0 || rows[i] != rows[n - 1]) && editorRowAt(rows[i])->render != NULL) rows[n++] = rows[i];
+  }
+  Editor.render_nrows = n;
+  if (n <= RENDER_CACHE_ROWS / 2) return;
+
+  unsigned int *used = malloc(sizeof(unsigned int) * n);
+  if (used == NULL) die("malloc");
+  for (int i = 0; i < n; i++) used[i] = editorRowAt(rows[i])->used;
+  cutoff = editorRenderCutoff(used, n);
+  free(used);
+
+  int kept = 0;
+  for (int i = 0; i < n; i++){
+    j = rows[i];
+    row = editorRowAt(j);
+    if (row->used <= cutoff && !editorRenderKeep(j)) editorRowEvict(row);
+    else rows[kept++] = j;
+  }
+  Editor.render_nrows = kept;
+}
+
+/* gives a row that still points into the file mapping its own copy of the text */
+void editorRowOwn(erow *row){
+  if (!(row->flags & ROW_MAPPED)) return;
+  char *chars = slabAlloc(&Editor.slab, row->size + 1);
+  memcpy(chars, row->chars, row->size);
+  chars[row->size] = '\0';
+  row->chars = chars;
+  if (row->flags & ROW_RENDER_ALIAS) row->render = chars;
+  row->flags &= ~ROW_MAPPED;
 }
 
 void editorDeleteRow(int at){
   if (at < 0 || at >= Editor.numrows) return;
-  editorFreeRow(&Editor.row[at]);
-  memmove(&Editor.row[at], &Editor.row[at+1], sizeof(erow) * (Editor.numrows - at - 1));
-  for (int j = at; j < Editor.numrows - 1; j++) Editor.row[j].idx--;
+  erow *row = editorRowAt(at);
+  editorUndoRecord(UNDO_DELETE_ROW, at, 0, row->chars, row->size);
+  editorFreeRow(row);
+  rowsDelete(&Editor.rows, at);
   Editor.numrows--;
+  editorSyntaxShift(at, -1);
+  editorSyntaxDamage(at);
+  Editor.dirty++;
+}
+
+void editorRowInsertString(int filerow, int at, char *s, size_t len){
+  erow *row = editorRowAt(filerow);
+  editorRowOwn(row);
+  if (at < 0 || at > row->size) at = row->size;
+  row->chars = slabRealloc(&Editor.slab, row->chars, row->size + len + 1);
+  memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+  memcpy(&row->chars[at], s, len);
+  row->size += len;
+  editorUndoRecord(UNDO_INSERT, filerow, at, s, len);
+  editorRowPatch(filerow, at, 0, len);
+  Editor.dirty++;
+}
+
+/* the next line break in [s, end), or end. \r\n, \r and \n all count */
+char *editorLineBreak(char *s, char *end){
+  while (s < end && *s != '\n' && *s != '\r') s++;
+  return s;
+}
+
+/* inserts text that may hold line breaks into row filerow at column at. the
+   row is split once, the rows after it are added unrendered and their
+   comment states are worked out in one pass. returns the number of line
+   breaks, *end_x is the column right after the text in the last row */
+int editorRowInsertText(int filerow, int at, char *s, size_t len, int *end_x){
+  char *end = s + len, *nl = editorLineBreak(s, end);
+  erow *row = editorRowAt(filerow);
+  if (at < 0 || at > row->size) at = row->size;
+  if (nl == end){
+    editorRowInsertString(filerow, at, s, len);
+    *end_x = at + len;
+    return 0;
+  }
+
+  editorRowOwn(row);
+
+  // what follows the column moves to the end of the last row
+  int tail_len = row->size - at;
+  char *tail = malloc(tail_len + 1);
+  if (tail == NULL) die("malloc");
+  memcpy(tail, &row->chars[at], tail_len);
+  if (tail_len) editorUndoRecord(UNDO_DELETE, filerow, at, tail, tail_len);
+
+  row->size = at + (nl - s);
+  row->chars = slabRealloc(&Editor.slab, row->chars, row->size + 1);
+  memcpy(&row->chars[at], s, nl - s);
+  row->chars[row->size] = '\0';
+  if (nl > s) editorUndoRecord(UNDO_INSERT, filerow, at, s, nl - s);
+  editorRenderRow(row, filerow);
+
+  int n = 0;
+  while (nl < end){
+    s = nl + (nl + 1 < end && nl[0] == '\r' && nl[1] == '\n' ? 2 : 1);
+    nl = editorLineBreak(s, end);
+
+    int line = nl - s, last = nl == end;
+    erow *r = rowsInsert(&Editor.rows, filerow + 1 + n);
+    r->size = line + (last ? tail_len : 0);
+    r->chars = slabAlloc(&Editor.slab, r->size + 1);
+    memcpy(r->chars, s, line);
+    if (last) memcpy(&r->chars[line], tail, tail_len);
+    r->chars[r->size] = '\0';
+    r->render = NULL;
+    r->render_size = 0;
+    r->hl = NULL;
+    r->hl_entry = r->hl_open_comment = 0;
+    r->flags = 0;
+    n++;
+    editorUndoRecord(UNDO_INSERT_ROW, filerow + n, 0, r->chars, r->size);
+    if (last) *end_x = line;
+  }
+  free(tail);
+
+  Editor.numrows += n;
+  Editor.dirty++;
+  editorSyntaxShift(filerow + 1, n);
+
+  int entry = editorRowEntryState(filerow);
+  if (entry == -1){
+    // past the frontier: the worker gets to all of them
+    row = editorRowAt(filerow);
+    row->hl = slabRealloc(&Editor.slab, row->hl, row->render_size);
+    memset(row->hl, PLAIN, row->render_size);
+    row->flags &= ~ROW_HL_MARKS;
+    return n;
+  }
+
+  struct rowIter it;
+  rowsIterAt(&Editor.rows, &it, filerow);
+  for (int k = 0; k <= n; k++) entry = editorLexRow(rowsIterNext(&it), entry);
+  editorSyntaxDamage(filerow + n + 1);
+  return n;
+}
+
+void editorRowInsertChar(int filerow, int at, int c){
+  char ch = c;
+  editorRowInsertString(filerow, at, &ch, 1);
+}
+
+void editorRowAppendString(int filerow, char *s, size_t len){
+  editorRowInsertString(filerow, editorRowAt(filerow)->size, s, len);
+}
+
+void editorRowDeleteRange(int filerow, int at, int len){
+  erow *row = editorRowAt(filerow);
+  if (at < 0 || at >= row->size) return;
+  if (len > row->size - at) len = row->size - at;
+  editorRowOwn(row);
+  editorUndoRecord(UNDO_DELETE, filerow, at, &row->chars[at], len);
+  memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+  row->size -= len;
+  editorRowPatch(filerow, at, len, 0);
   Editor.dirty++;
 }
 
-void editorRowInsertChar(erow *row, int at, int c){
-  if (at < 0 || at > row->size) at = row->size;
-  row->chars = realloc(row->chars, row->size+2);
-  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-  row->size++;
-  row->chars[at] = c;
-  editorUpdateRow(row);
-  Editor.dirty++;
+void editorRowDeleteChar(int filerow, int at){
+  editorRowDeleteRange(filerow, at, 1);
+}
+
+
+/*  editor operations  */
+
+void editorInsertChar(int c){
+  if (Editor.cursor_y == Editor.numrows){
+    editorInsertRow("", Editor.numrows, 0);
+  }
+  editorRowInsertChar(Editor.cursor_y, Editor.cursor_x, c);
+  Editor.cursor_x++;
+}
+
+void editorDeleteChar(){
+  if (editorReadOnly()) return;
+  if (Editor.cursor_y == Editor.numrows) return;
+  if (Editor.cursor_x == 0 && Editor.cursor_y == 0) return;
+  
+  if (Editor.cursor_x > 0){
+    editorRowDeleteChar(Editor.cursor_y, Editor.cursor_x - 1);
+    Editor.cursor_x--;
+  } else{
+    erow *row = editorRowAt(Editor.cursor_y);
+    Editor.cursor_x = editorRowAt(Editor.cursor_y - 1)->size;
+    editorRowAppendString(Editor.cursor_y - 1, row->chars, row->size);
+    editorDeleteRow(Editor.cursor_y);
+    Editor.cursor_y--;
+  }
+}
+
+void editorInsertNewline(){
+  if (Editor.cursor_x == 0){
+    editorInsertRow("", Editor.cursor_y, 0);
+  } else {
+    erow *row = editorRowAt(Editor.cursor_y);
+    editorInsertRow(&row->chars[Editor.cursor_x], Editor.cursor_y + 1, row->size - Editor.cursor_x);
+    row = editorRowAt(Editor.cursor_y);
+    editorRowDeleteRange(Editor.cursor_y, Editor.cursor_x, row->size - Editor.cursor_x);
+  }
+  Editor.cursor_y++;
+  Editor.cursor_x = 0;
+}
+
+/* inserts pasted text at the cursor as an undo group of its own */
+void editorPaste(char *s, size_t len){
+  int x;
+  if (len == 0 || editorReadOnly()) return;
+
+  undoBreak(&Editor.undo);
+  if (Editor.cursor_y == Editor.numrows){
+    editorInsertRow("", Editor.numrows, 0);
+  }
+  Editor.cursor_y += editorRowInsertText(Editor.cursor_y, Editor.cursor_x, s, len, &x);
+  Editor.cursor_x = x;
+  undoBreak(&Editor.undo);
+}
+
+/*  undo  */
+
+void editorUndoRecord(int type, int row, int col, char *s, int len){
+  if (!Editor.undo_paused) undoRecord(&Editor.undo, type, row, col, s, len);
+}
+
+/* reverts the last group of edits and leaves the cursor where the first of them happened */
+void editorUndo(){
+  struct undoOp *op;
+  int n = 0;
+
+  Editor.undo_paused = 1;
+  while ((op = undoPrev(&Editor.undo)) != NULL){
+    char *text = undoText(&Editor.undo, op);
+    switch (op->type){
+      case UNDO_INSERT:
+        editorRowDeleteRange(op->row, op->col, op->len);
+        break;
+      case UNDO_DELETE:
+        editorRowInsertString(op->row, op->col, text, op->len);
+        break;
+      case UNDO_INSERT_ROW:
+        editorDeleteRow(op->row);
+        break;
+      case UNDO_DELETE_ROW:
+        editorInsertRow(text, op->row, op->len);
+        break;
+    }
+    Editor.cursor_y = op->row;
+    Editor.cursor_x = op->col;
+    n++;
+    if (op->flags & UNDO_GROUP) break;
+  }
+  Editor.undo_paused = 0;
+
+  if (n == 0) editorSetStatusMessage("Already at oldest change");
+}
+
+/* applies the next group of undone edits again */
+void editorRedo(){
+  struct undoOp *op;
+  int n = 0;
+
+  Editor.undo_paused = 1;
+  while ((op = undoNext(&Editor.undo)) != NULL){
+    char *text = undoText(&Editor.undo, op);
+    Editor.cursor_y = op->row;
+    Editor.cursor_x = op->col;
+    switch (op->type){
+      case UNDO_INSERT:
+        editorRowInsertString(op->row, op->col, text, op->len);
+        Editor.cursor_x += op->len;
+        break;
+      case UNDO_DELETE:
+        editorRowDeleteRange(op->row, op->col, op->len);
+        break;
+      case UNDO_INSERT_ROW:
+        editorInsertRow(text, op->row, op->len);
+        break;
+      case UNDO_DELETE_ROW:
+        editorDeleteRow(op->row);
+        break;
+    }
+    n++;
+    if (Editor.undo.cur < Editor.undo.count && (Editor.undo.ops[Editor.undo.cur].flags & UNDO_GROUP)) break;
+  }
+  Editor.undo_paused = 0;
+
+  if (n == 0) editorSetStatusMessage("Already at newest change");
+}
+
+/*  search  */
+
+/* two mapped rows that follow each other in the file, with only the line break between them */
+int editorRowsAdjacent(erow *a, erow *b){
+  if (!(a->flags & ROW_MAPPED) || !(b->flags & ROW_MAPPED)) return 0;
+
+  char *p = a->chars + a->size;
+  if (b->chars <= p || b->chars[-1] != '\n') return 0;
+  while (p < b->chars - 1 && *p == '\r') p++;
+  return p == b->chars - 1;
+}
+
+/* turns a match inside a block of rows starting at row first into a row and column */
+void editorSearchHit(int first, char *m, int *ry, int *rx){
+  struct rowIter it;
+  erow *row;
+  int j = first;
+
+  rowsIterAt(&Editor.rows, &it, first);
+  while ((row = rowsIterNext(&it)) != NULL){
+    if (m >= row->chars && m <= row->chars + row->size) break;
+    j++;
+  }
+  *ry = j;
+  *rx = row ? m - row->chars : 0;
+}
+
+/* searches rows from up to but not including to, mapped rows that are
+   adjacent in the file are searched as one block of up to SEARCH_SPAN */
+int editorSearchRows(int from, int to, int *ry, int *rx, int *rlen){
+  struct rowIter it;
+  erow *row, *next;
+  int j = from;
+
+  rowsIterAt(&Editor.rows, &it, from);
+  row = rowsIterNext(&it);
+  while (row != NULL && j < to){
+    char *start = row->chars, *end = row->chars + row->size;
+    int first = j;
+
+    while ((next = rowsIterNext(&it)) != NULL && j + 1 < to && editorRowsAdjacent(row, next) &&
+           next->chars + next->size - start <= SEARCH_SPAN){
+      end = next->chars + next->size;
+      row = next;
+      j++;
+    }
+
+    char *m = searchNext(&Editor.search, start, start, end, rlen);
+    if (m){
+      editorSearchHit(first, m, ry, rx);
+      return 1;
+    }
+    row = next;
+    j++;
+  }
+  return 0;
+}
+
+/* the same going upwards from row from down to row to, finding the last match first */
+int editorSearchRowsBack(int from, int to, int *ry, int *rx, int *rlen){
+  struct rowIter it;
+  erow *row, *prev;
+  int j = from;
+
+  if (from < to) return 0;
+  rowsIterAt(&Editor.rows, &it, from);
+  row = rowsIterPrev(&it);
+  while (row != NULL && j >= to){
+    char *start = row->chars, *end = row->chars + row->size;
+
+    while ((prev = rowsIterPrev(&it)) != NULL && j - 1 >= to && editorRowsAdjacent(prev, row) &&
+           end - prev->chars <= SEARCH_SPAN){
+      start = prev->chars;
+      row = prev;
+      j--;
+    }
+
+    char *m = searchLast(&Editor.search, start, end, end, rlen);
+    if (m){
+      editorSearchHit(j, m, ry, rx);
+      return 1;
+    }
+    row = prev;
+    j--;
+  }
+  return 0;
+}
+
+/* moves the viewer's window to a match outside it */
+void editorSearchJump(char *m, int *ry, int *rx){
+  char *nl = memrchr(Editor.map, '\n', m - Editor.map);
+  char *start = nl ? nl + 1 : Editor.map;
+
+  *ry = editorViewReach(start - Editor.map, -1);
+  *rx = m - start;
+}
+
+/* searches the part of the mapped file not loaded yet, rows are loaded up to a match
+   while the viewer moves its window there */
+int editorSearchTail(int dir, int *ry, int *rx, int *rlen){
+  if (Editor.map == NULL || Editor.map_offset >= Editor.map_size) return 0;
+
+  char *start = Editor.map + Editor.map_offset, *end = Editor.map + Editor.map_size;
+  char *m = dir > 0 ? searchNext(&Editor.search, start, start, end, rlen)
+                    : searchLast(&Editor.search, start, end, end, rlen);
+  if (m == NULL) return 0;
+
+  if (Editor.viewer){
+    editorSearchJump(m, ry, rx);
+    return 1;
+  }
+  while (Editor.map_offset <= (size_t)(m - Editor.map)) editorLoadUntil(Editor.numrows);
+  *ry = Editor.numrows - 1;
+  *rx = m - editorRowAt(*ry)->chars;
+  return 1;
+}
+
+/* searches the part of the mapped file in front of the viewer's window */
+int editorSearchHead(int dir, int *ry, int *rx, int *rlen){
+  if (!Editor.viewer || Editor.view_offset == 0) return 0;
+
+  char *start = Editor.map, *end = Editor.map + Editor.view_offset;
+  char *m = dir > 0 ? searchNext(&Editor.search, start, start, end, rlen)
+                    : searchLast(&Editor.search, start, end, end, rlen);
+  if (m == NULL) return 0;
+
+  editorSearchJump(m, ry, rx);
+  return 1;
+}
+
+/* finds the next match from row y, column x in direction dir, wrapping around the end of the file.
+   forwards a match may start at x, backwards it has to start before it */
+int editorSearch(int dir, int y, int x, int *ry, int *rx, int *rlen){
+  erow *row = y < Editor.numrows ? editorRowAt(y) : NULL;
+  char *m = NULL;
+
+  if (Editor.search.len == 0) return 0;
+
+  if (dir > 0){
+    if (row && x <= row->size) m = searchNext(&Editor.search, row->chars, &row->chars[x], row->chars + row->size, rlen);
+    if (m == NULL){
+      return editorSearchRows(y + 1, Editor.numrows, ry, rx, rlen) ||
+             editorSearchTail(dir, ry, rx, rlen) ||
+             editorSearchHead(dir, ry, rx, rlen) ||
+             editorSearchRows(0, y + 1, ry, rx, rlen);
+    }
+  } else {
+    if (row && x > 0) m = searchLast(&Editor.search, row->chars, &row->chars[x], row->chars + row->size, rlen);
+    if (m == NULL){
+      if (editorSearchRowsBack(y - 1, 0, ry, rx, rlen) || editorSearchHead(dir, ry, rx, rlen) ||
+          editorSearchTail(dir, ry, rx, rlen)) return 1;
+      return editorSearchRowsBack(Editor.numrows - 1, y, ry, rx, rlen);
+    }
+  }
+
+  *ry = y;
+  *rx = m - row->chars;
+  return 1;
+}
+
+/* shows a match by overwriting the hl of its row, until editorSearchClear lexes the row again */
+void editorSearchMark(int y, int x, int len){
+  erow *row = editorRowMaterialize(y);
+  int from = editorRowCxToRx(row, x) - LEFT_PADDING;
+  int to = editorRowCxToRx(row, x + len) - LEFT_PADDING;
+
+  if (to > row->render_size) to = row->render_size;
+  if (from < to) memset(&row->hl[from], HL_MATCH, to - from);
+  Editor.match_row = y;
+}
+
+void editorSearchClear(){
+  if (Editor.match_row == -1) return;
+  if (Editor.match_row < Editor.numrows){
+    erow *row = editorRowAt(Editor.match_row);
+    if (row->render != NULL){
+      if (row->flags & ROW_HL_VALID) editorRelexRow(row, Editor.match_row);
+      else editorUpdateSyntax(Editor.match_row);
+    }
+  }
+  Editor.match_row = -1;
+}
+
+void editorSearchGo(int dir, int y, int x){
+  int ry, rx, len;
+
+  if (editorSearch(dir, y, x, &ry, &rx, &len)){
+    Editor.cursor_y = ry;
+    Editor.cursor_x = rx;
+    editorSearchMark(ry, rx, len);
+  } else {
+    editorSetStatusMessage("Pattern not found: %s", Editor.search.s);
+  }
+}
+
+/* puts the cursor back where the search started, the viewer's window goes back there too */
+void editorSearchOrigin(){
+  Editor.cursor_y = Editor.viewer ? editorViewReach(Editor.search_at, -1) : Editor.search_y;
+  Editor.cursor_x = Editor.search_x;
+}
+
+/* prompt callback: every change to the query searches again from where the search started,
+   the arrow keys step between matches */
+void editorFindCallback(char *query, int key){
+  editorSearchClear();
+
+  if (key == ESCAPE) return;
+  if (key == '\r'){
+    if (Editor.search.len) editorSearchGo(1, Editor.cursor_y, Editor.cursor_x);
+    return;
+  }
+
+  if (key == ARROW_RIGHT || key == ARROW_DOWN){
+    editorSearchGo(1, Editor.cursor_y, Editor.cursor_x + 1);
+  } else if (key == ARROW_LEFT || key == ARROW_UP){
+    editorSearchGo(-1, Editor.cursor_y, Editor.cursor_x);
+  } else {
+    searchFree(&Editor.search);
+    editorSearchOrigin();
+    if (searchCompile(&Editor.search, query, strlen(query)) == -1){
+      editorSetStatusMessage("Invalid pattern: %s", query);
+      return;
+    }
+    if (Editor.search.len) editorSearchGo(1, Editor.cursor_y, Editor.cursor_x);
+  }
+}
+
+void editorFind(){
+  int row_offset = Editor.row_offset;
+  int col_offset = Editor.col_offset;
+
+  Editor.search_y = Editor.cursor_y;
+  Editor.search_x = Editor.cursor_x;
+  if (Editor.viewer){
+    Editor.search_at = Editor.cursor_y < Editor.numrows ? (size_t)(editorRowAt(Editor.cursor_y)->chars - Editor.map)
+                                                        : Editor.map_offset;
+  }
+
+  char *query = editorPrompt("/%s", editorFindCallback);
+  if (query){
+    free(query);
+  } else {
+    editorSearchOrigin();
+    Editor.row_offset = row_offset;
+    Editor.col_offset = col_offset;
+  }
+}
+
+/* n and N: the next match of the last search after or before the cursor */
+void editorFindNext(int dir){
+  if (Editor.search.len == 0){
+    editorSetStatusMessage("No previous search");
+    return;
+  }
+  editorSearchGo(dir, Editor.cursor_y, dir > 0 ? Editor.cursor_x + 1 : Editor.cursor_x);
+}
+
+/*  file i/o  */
+
+/*
+  Rows point into a private mapping of the file until they are edited. If
+  another program cuts the file short, reading a page past its new end
+  raises SIGBUS: the handler swaps that page and the rest of the mapping
+  for zero pages, so the text there reads as NUL bytes instead, and the
+  editor says so. A save first checks how much of the file is left and
+  drops what was cut from the rows and the rest of the mapping.
+*/
+
+struct mapGuard {
+  long page;
+  size_t lost;                // offset the mapping reads as zeros from, SIZE_MAX while whole
+  volatile sig_atomic_t hit;  // a fault was handled since the editor last said so
+} MapGuard = {0, SIZE_MAX, 0};
+
+void editorMapFault(int sig, siginfo_t *info, void *context){
+  (void)context;
+  char *addr = info->si_addr, *map = Editor.map;
+
+  if (map != NULL && addr >= map && addr < map + Editor.map_len){
+    char *from = map + (addr - map) / MapGuard.page * MapGuard.page;
+    if (mmap(from, map + Editor.map_len - from, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED){
+      if ((size_t)(from - map) < MapGuard.lost) MapGuard.lost = from - map;
+      MapGuard.hit = 1;
+      return;
+    }
+  }
+  // not the mapping: the fault is real, it happens again without the handler
+  signal(sig, SIG_DFL);
+}
+
+/* a new mapping is whole, the handler goes in with the first one */
+void editorMapGuard(){
+  struct sigaction sa;
+
+  MapGuard.lost = SIZE_MAX;
+  if (MapGuard.page) return;
+
+  MapGuard.page = sysconf(_SC_PAGESIZE);
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = editorMapFault;
+  sa.sa_flags = SA_SIGINFO;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGBUS, &sa, NULL) == -1) die("sigaction");
+}
+
+/* ends the mapping where the file now ends, or where it started to read as zeros. the rows
+   loaded from past that point go, the one it cuts through keeps what is left of it */
+void editorMapClip(){
+  struct stat st;
+  size_t end = Editor.map_size;
+
+  if (Editor.map == NULL) return;
+  if (fstat(Editor.map_fd, &st) == 0 && (size_t)st.st_size < end) end = st.st_size;
+  if (MapGuard.lost < end) end = MapGuard.lost;
+  if (end == Editor.map_size) return;
+
+  Editor.map_size = end;
+  if (Editor.map_offset > end) Editor.map_offset = end;
+
+  char *cut = Editor.map + end;
+  Editor.undo_paused = 1;
+  for (int j = Editor.numrows - 1; j >= 0; j--){
+    erow *row = editorRowAt(j);
+    if (!(row->flags & ROW_MAPPED) || row->chars + row->size <= cut) continue;
+    if (row->chars >= cut){
+      editorDeleteRow(j);
+    } else {
+      row->size = cut - row->chars;
+      editorUpdateRow(j);
+    }
+  }
+  Editor.undo_paused = 0;
+
+  if (Editor.cursor_y >= Editor.numrows){
+    Editor.cursor_y = Editor.numrows;
+    Editor.cursor_x = 0;
+  } else if (Editor.cursor_x > editorRowAt(Editor.cursor_y)->size){
+    Editor.cursor_x = editorRowAt(Editor.cursor_y)->size;
+  }
+}
+
+/* turns up to max lines of s[0, len) into rows after the last one. the newlines of
+   LOAD_BATCH lines are found in one pass and the rows for them opened a leaf at a
+   time. rows point into s when mapped is set and get a copy of their text otherwise.
+   text after the last newline only becomes a row when last is set. returns the bytes
+   that went into rows */
+size_t editorAppendRows(char *s, size_t len, long long max, int mapped, int last){
+  size_t nl[LOAD_BATCH];
+  char *start = s, *end = s + len;
+
+  while (max > 0 && start < end){
+    int want = max < LOAD_BATCH ? max : LOAD_BATCH;
+    int n = linesSplit(start, end - start, nl, want);
+    int rows = n;
+    char *base = start;
+
+    if (n < want && last && (n == 0 || base + nl[n - 1] + 1 < end)) rows++;
+
+    for (int k = 0; k < rows;){
+      int batch = rows - k;
+      erow *row = rowsAppend(&Editor.rows, &batch);
+
+      for (int j = 0; j < batch; j++, k++){
+        char *stop = k < n ? base + nl[k] : end;
+        size_t linelen = stop - start;
+
+        if (k < n){
+          if (linelen > 0 && start[linelen - 1] == '\r') Editor.eol_crlf++;
+          else Editor.eol_lf++;
+        }
+        while (linelen > 0 && start[linelen - 1] == '\r') linelen--;
+
+        row[j].size = linelen;
+        if (mapped){
+          row[j].chars = start;
+          row[j].flags = ROW_MAPPED;
+        } else {
+          row[j].chars = slabAlloc(&Editor.slab, linelen + 1);
+          memcpy(row[j].chars, start, linelen);
+          row[j].chars[linelen] = '\0';
+        }
+        start = k < n ? stop + 1 : stop;
+      }
+      Editor.numrows += batch;
+    }
+
+    max -= rows;
+    if (n < want) break;
+  }
+
+  return start - s;
 }
 
-void editorRowAppendString(erow *row, char *s, size_t len){
-  row->chars = realloc(row->chars, row->size + len + 1);
-  memcpy(&row->chars[row->size], s, len);
-  row->size += len;
-  row->chars[row->size] = '\0';
-  editorUpdateRow(row);
-  Editor.dirty++;
+/* lines end in \r\n rather than \n, going by those loaded so far */
+int editorCrlf(){
+  return Editor.eol_crlf > Editor.eol_lf;
 }
 
-void editorRowDeleteChar(erow *row, int at){
-  if (at < 0 || at >= row->size) return;
-  memmove(&row->chars[at],&row->chars[at+1], row->size - at);
-  row->size--;
-  editorUpdateRow(row);
-  Editor.dirty++;
+/* turns lines of the mapped file into rows until filerow exists or the file ends */
+void editorLoadUntil(int filerow){
+  if (Editor.numrows > filerow || Editor.map_offset >= Editor.map_size) return;
+  Editor.map_offset += editorAppendRows(Editor.map + Editor.map_offset, Editor.map_size - Editor.map_offset,
+                                        (long long)filerow + 1 - Editor.numrows, 1, 1);
 }
 
+/* loads the next slice of the mapped file while waiting for input, returns 1 while more is left */
+int editorLoadIdle(){
+  if (Editor.viewer) return 0;  // the viewer only loads what its window needs
 
-/*  editor operations  */
+  size_t left = Editor.map_size - Editor.map_offset;
+  size_t chunk = left < LOAD_CHUNK ? left : LOAD_CHUNK;
+  if (chunk == 0) return 0;
 
-void editorInsertChar(int c){
-  if (Editor.cursor_y == Editor.numrows){
-    editorInsertRow("", Editor.numrows, 0);
-  }
-  editorRowInsertChar(&Editor.row[Editor.cursor_y], Editor.cursor_x, c);
-  Editor.cursor_x++;
+  size_t used = editorAppendRows(Editor.map + Editor.map_offset, chunk, LLONG_MAX, 1, chunk == left);
+  if (used > 0) Editor.map_offset += used;
+  else editorLoadUntil(Editor.numrows);  // a line longer than the slice
+  return Editor.map_offset < Editor.map_size;
 }
 
-void editorDeleteChar(){
-  if (Editor.cursor_y == Editor.numrows) return;
-  if (Editor.cursor_x == 0 && Editor.cursor_y == 0) return;
-  
-  erow *row = &Editor.row[Editor.cursor_y];
-  if (Editor.cursor_x > 0){
-    editorRowDeleteChar(row, Editor.cursor_x - 1);
-    Editor.cursor_x--;
-  } else{
-    Editor.cursor_x = Editor.row[Editor.cursor_y - 1].size;
-    editorRowAppendString(&Editor.row[Editor.cursor_y - 1], row->chars, row->size);
-    editorDeleteRow(Editor.cursor_y);
-    Editor.cursor_y--;
+/* gathers pieces of the file into iovecs and sends them with writev whenever they fill up */
+struct saveBuf {
+  int fd;
+  int crlf;  // lines end in \r\n
+  int n;
+  size_t total;
+  struct iovec iov[SAVE_IOV];
+};
+
+int editorSaveFlush(struct saveBuf *sb){
+  struct iovec *iov = sb->iov;
+  int n = sb->n;
+
+  while (n > 0){
+    ssize_t written = writev(sb->fd, iov, n);
+    if (written == -1){
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    sb->total += written;
+    // skip what went out, a short write can stop in the middle of an iovec
+    while (n > 0 && (size_t)written >= iov->iov_len){
+      written -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0){
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
   }
+  sb->n = 0;
+  return 0;
 }
 
-void editorInsertNewline(){
-  if (Editor.cursor_x == 0){
-    editorInsertRow("", Editor.cursor_y, 0);
-  } else {
-    erow *row = &Editor.row[Editor.cursor_y];
-    editorInsertRow(&row->chars[Editor.cursor_x], Editor.cursor_y + 1, row->size - Editor.cursor_x);
-    row = &Editor.row[Editor.cursor_y];
-    row->size = Editor.cursor_x;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-  }
-  Editor.cursor_y++;
-  Editor.cursor_x = 0;
+int editorSaveLine(struct saveBuf *sb, char *s, size_t len){
+  if (sb->n + 2 > SAVE_IOV && editorSaveFlush(sb) == -1) return -1;
+  sb->iov[sb->n].iov_base = s;
+  sb->iov[sb->n].iov_len = len;
+  sb->iov[sb->n + 1].iov_base = sb->crlf ? "\r\n" : "\n";
+  sb->iov[sb->n + 1].iov_len = sb->crlf ? 2 : 1;
+  sb->n += 2;
+  return 0;
 }
 
-/*  file i/o  */
+/* writes every row to fd straight from where it lives, lines of the mapped
+   file that were never loaded are cut out of the mapping on the way */
+int editorWriteRows(int fd, size_t *total){
+  struct saveBuf sb;
+  struct rowIter it;
+  erow *row;
 
-char *editorRowsToString(int *buflen){
-  int totlen = 0;
-  int j;
+  sb.fd = fd;
+  sb.crlf = editorCrlf();
+  sb.n = 0;
+  sb.total = 0;
 
-  for (j = 0; j < Editor.numrows; j++){
-    totlen += Editor.row[j].size + 1;
+  rowsIterAt(&Editor.rows, &it, 0);
+  while ((row = rowsIterNext(&it)) != NULL){
+    if (editorSaveLine(&sb, row->chars, row->size) == -1) return -1;
   }
-  *buflen = totlen;
 
-  char *buf = malloc(totlen);
-  char *p = buf;
+  size_t offset = Editor.map_offset;
+  while (offset < Editor.map_size){
+    char *start = Editor.map + offset;
+    size_t left = Editor.map_size - offset;
+    char *nl = memchr(start, '\n', left);
+    size_t linelen = nl ? (size_t)(nl - start) : left;
 
-  for (j = 0; j < Editor.numrows; j++){
-    memcpy(p, Editor.row[j].chars, Editor.row[j].size);
-    p += Editor.row[j].size;
-    *p = '\n';
-    p++;
+    offset += nl ? linelen + 1 : linelen;
+    while (linelen > 0 && start[linelen - 1] == '\r') linelen--;
+    if (editorSaveLine(&sb, start, linelen) == -1) return -1;
   }
 
-  return buf;
+  if (editorSaveFlush(&sb) == -1) return -1;
+  *total = sb.total;
+  return 0;
 }
 
-void editorOpen(char *filename){
+/* opens filename, in the viewer when view is set or the file is too large to load */
+void editorOpenFile(char *filename, int view){
   if (filename == NULL) return;
 
   if (Editor.filename != NULL) free(Editor.filename);
@@ -396,26 +2157,159 @@ void editorOpen(char *filename){
   char *ext = strrchr(Editor.filename, '.');
   if (ext != NULL) lexerSetSyntax(ext);
 
-  FILE *fp = fopen(Editor.filename, "r");
-  if (!fp) die("open");
+  int fd = open(Editor.filename, O_RDONLY);
+  if (fd == -1) die("open");
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED){
+      editorMapGuard();
+      Editor.map = map;
+      Editor.map_fd = fd;
+      Editor.map_size = Editor.map_len = st.st_size;
+      Editor.map_offset = 0;
+      Editor.viewer = view || st.st_size >= VIEW_MIN_BYTES;
+      if (Editor.viewer){
+        linesIndexStart(map, st.st_size);
+        editorViewAt(0, 0);
+      } else {
+        editorLoadUntil(Editor.screen_rows);
+      }
+      Editor.dirty = 0;
+      return;
+    }
+  }
 
-  char *line = NULL;
-  size_t linecap = 0;
-  ssize_t linelen;
+  // anything that cannot be mapped is read in blocks, the whole lines of each become rows at once
+  size_t cap = LOAD_CHUNK, len = 0;
+  ssize_t got;
+  char *buf = malloc(cap);
+  if (buf == NULL) die("malloc");
+
+  do {
+    if (len == cap){
+      cap *= 2;
+      buf = realloc(buf, cap);
+      if (buf == NULL) die("realloc");
+    }
+    got = read(fd, buf + len, cap - len);
+    if (got == -1){
+      if (errno == EINTR) continue;
+      die("read");
+    }
+    len += got;
 
-  while ((linelen = getline(&line, &linecap, fp)) != -1){
-    while (linelen > 0 && (line[linelen - 1] == '\n' ||
-                           line[linelen - 1] == '\r'))
-      linelen--;
-    editorInsertRow(line, Editor.numrows, linelen);
-  }
+    size_t used = editorAppendRows(buf, len, LLONG_MAX, 0, got == 0);
+    memmove(buf, buf + used, len - used);
+    len -= used;
+  } while (got != 0);
 
-  free(line);
-  fclose(fp);
+  free(buf);
+  close(fd);
   Editor.dirty = 0;
 }
 
+void editorOpen(char *filename){
+  editorOpenFile(filename, 0);
+}
+
+/* opens filename read-only in the viewer, files that cannot be mapped are loaded as usual */
+void editorView(char *filename){
+  editorOpenFile(filename, 1);
+}
+
+/* makes a rename in the directory of path durable, where the filesystem allows it */
+void editorSyncDir(char *path){
+  char *slash = strrchr(path, '/');
+  char *dir = slash == NULL ? strdup(".") : strndup(path, slash == path ? 1 : (size_t)(slash - path));
+  if (dir == NULL) die("strdup");
+
+  int fd = open(dir, O_RDONLY | O_DIRECTORY);
+  if (fd != -1){
+    fsync(fd);
+    close(fd);
+  }
+  free(dir);
+}
+
+/* writes the rows to a temp file next to target and renames it over target, the old
+   file stays whole until then and a mapping of it stays readable after. the new file
+   takes the old one's owner and mode, st is NULL when there was none */
+int editorSaveReplace(char *target, struct stat *st, size_t *len){
+  mode_t mode;
+  if (st != NULL){
+    mode = st->st_mode & 07777;
+  } else {
+    mode_t mask = umask(0);
+    umask(mask);
+    mode = 0644 & ~mask;
+  }
+
+  char *tmp = malloc(strlen(target) + 8);
+  if (tmp == NULL) die("malloc");
+  sprintf(tmp, "%s.XXXXXX", target);
+
+  int fd = mkstemp(tmp);
+  if (fd == -1){
+    free(tmp);
+    return -1;
+  }
+  // only root can give a file away, anyone else keeps it and the owner's group may not be theirs
+  int owned = st == NULL || fchown(fd, st->st_uid, st->st_gid) != -1 || errno == EPERM;
+  if (owned && fchmod(fd, mode) != -1 && editorWriteRows(fd, len) != -1 && fsync(fd) != -1){
+    if (close(fd) != -1 && rename(tmp, target) != -1){
+      free(tmp);
+      editorSyncDir(target);
+      return 0;
+    }
+  } else {
+    close(fd);
+  }
+
+  int err = errno;
+  unlink(tmp);
+  free(tmp);
+  errno = err;
+  return -1;
+}
+
+/* the file stops being read through its mapping: the lines not loaded yet become
+   rows and every row gets its own copy of its text */
+void editorUnmap(){
+  if (Editor.map == NULL) return;
+  while (Editor.map_offset < Editor.map_size) editorLoadUntil(Editor.numrows);
+
+  struct rowIter it;
+  erow *row;
+  rowsIterAt(&Editor.rows, &it, 0);
+  while ((row = rowsIterNext(&it)) != NULL) editorRowOwn(row);
+
+  munmap(Editor.map, Editor.map_len);
+  close(Editor.map_fd);
+  Editor.map = NULL;
+  Editor.map_size = Editor.map_offset = Editor.map_len = 0;
+}
+
+/* writes over target itself, for a file with other hard links a rename would leave
+   behind. the rows stop pointing into the mapping first, it is the same file */
+int editorSaveInPlace(char *target, size_t *len){
+  editorUnmap();
+
+  int fd = open(target, O_WRONLY);
+  if (fd == -1) return -1;
+  if (editorWriteRows(fd, len) != -1 && ftruncate(fd, *len) != -1 && fsync(fd) != -1){
+    return close(fd);
+  }
+
+  int err = errno;
+  close(fd);
+  errno = err;
+  return -1;
+}
+
 void editorSave(char *filename){
+  if (editorReadOnly()) return;
   if (filename != NULL){
     free(Editor.filename);
     Editor.filename = strdup(filename);
@@ -425,9 +2319,7 @@ void editorSave(char *filename){
       lexerSetSyntax(ext);
     }
 
-    for (int filerow = 0; filerow < Editor.numrows; filerow++){
-      editorUpdateSyntax(&Editor.row[filerow]);
-    }
+    editorUpdateAllSyntax();
 
   }
 
@@ -444,39 +2336,280 @@ void editorSave(char *filename){
       lexerSetSyntax(ext);
     }
 
-    for (int filerow = 0; filerow < Editor.numrows; filerow++){
-      editorUpdateSyntax(&Editor.row[filerow]);
-    }
+    editorUpdateAllSyntax();
 
   };
   
-  int len;
-  char *buf = editorRowsToString(&len);
-  
-  int fd = open(Editor.filename, O_RDWR | O_CREAT, 0644);
-  if (fd != -1){
-    if (ftruncate(fd, len) != -1){
-      if (write(fd, buf, len) == len){
-        close(fd);
-        free(buf);
-        Editor.dirty = 0;
-        editorSetStatusMessage("%d bytes written to disk", len);
-        return;
-      }
+  // what another program cut from the file since it was mapped is not written back as zeros
+  editorMapClip();
+
+  // a symlink is followed, the file it names is the one replaced
+  char *target = realpath(Editor.filename, NULL);
+  if (target == NULL){
+    target = strdup(Editor.filename);
+    if (target == NULL) die("strdup");
+  }
+
+  struct stat st;
+  int exists = stat(target, &st) == 0;
+
+  size_t len = 0;
+  int saved = exists && st.st_nlink > 1 ? editorSaveInPlace(target, &len) : editorSaveReplace(target, exists ? &st : NULL, &len);
+  free(target);
+
+  if (saved == -1){
+    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+    return;
+  }
+  Editor.dirty = 0;
+  editorSetStatusMessage("%zu bytes written to disk", len);
+}
+
+
+/*  viewer  */
+
+/*
+  A file opened with -R, or of VIEW_MIN_BYTES and more, is only ever
+  read: the rows are a window onto the mapping from view_offset to
+  map_offset. Rows are added in front of the window as the cursor nears
+  its top and behind it as usual, and once there are more than VIEW_ROWS
+  those far from the cursor go again. A jump puts the window somewhere
+  else altogether.
+
+  Line numbers come from the index lines.c builds in the background. A
+  jump to a line the index has passed is a lookup and a scan over fewer
+  than LINES_STEP lines, one to a line it has not reached waits in
+  editorIdle. The window starts lexing outside a comment.
+*/
+
+/* refuses an edit in the viewer */
+int editorReadOnly(){
+  if (!Editor.viewer) return 0;
+  editorSetStatusMessage("Read-only view");
+  return 1;
+}
+
+/* the window's rows changed all at once: highlighting starts over from its top */
+void editorViewReset(){
+  Editor.hl_npending = 0;
+  Editor.hl_frontier = 0;
+  Editor.hl_epoch++;
+}
+
+/* adds up to count lines of the mapping in front of the window */
+void editorViewBack(int count){
+  int n = 0;
+
+  while (n < count && Editor.view_offset > 0){
+    char *end = Editor.map + Editor.view_offset - 1;  // the newline of the line before
+    char *nl = memrchr(Editor.map, '\n', end - Editor.map);
+    char *start = nl ? nl + 1 : Editor.map;
+    size_t linelen = end - start;
+
+    while (linelen > 0 && start[linelen - 1] == '\r') linelen--;
+
+    erow *row = rowsInsert(&Editor.rows, 0);
+    row->chars = start;
+    row->size = linelen;
+    row->flags = ROW_MAPPED;
+    Editor.numrows++;
+    Editor.view_offset = start - Editor.map;
+    n++;
+  }
+  if (n == 0) return;
+
+  Editor.cursor_y += n;
+  Editor.row_offset += n;
+  if (Editor.match_row != -1) Editor.match_row += n;
+  if (Editor.view_offset == 0) Editor.view_line = 0;
+  else if (Editor.view_line >= 0) Editor.view_line -= n;
+  Editor.view_shift -= n;
+  editorViewReset();
+}
+
+/* drops the rows more than VIEW_ROWS / 4 away from the cursor once there are more than VIEW_ROWS */
+void editorViewTrim(){
+  if (Editor.numrows <= VIEW_ROWS) return;
+
+  int first = Editor.cursor_y - VIEW_ROWS / 4;
+  int last = Editor.cursor_y + Editor.screen_rows + VIEW_ROWS / 4;
+
+  if (last < Editor.numrows){
+    Editor.map_offset = editorRowAt(last)->chars - Editor.map;
+    while (Editor.numrows > last){
+      editorFreeRow(editorRowAt(Editor.numrows - 1));
+      rowsDelete(&Editor.rows, Editor.numrows - 1);
+      Editor.numrows--;
     }
-    close(fd);
   }
-  free(buf);
-  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+
+  if (first > 0){
+    Editor.view_offset = editorRowAt(first)->chars - Editor.map;
+    for (int j = 0; j < first; j++){
+      editorFreeRow(editorRowAt(0));
+      rowsDelete(&Editor.rows, 0);
+    }
+    Editor.numrows -= first;
+    Editor.cursor_y -= first;
+    Editor.row_offset = Editor.row_offset > first ? Editor.row_offset - first : 0;
+    if (Editor.match_row != -1) Editor.match_row = Editor.match_row >= first ? Editor.match_row - first : -1;
+    if (Editor.view_line >= 0) Editor.view_line += first;
+    Editor.view_shift += first;
+  }
+  editorViewReset();
+}
+
+/* grows the window in front when the cursor nears its top and trims it around the cursor */
+void editorViewKeep(){
+  if (!Editor.viewer) return;
+
+  int top = Editor.cursor_y < Editor.row_offset ? Editor.cursor_y : Editor.row_offset;
+  if (top < 2 * Editor.screen_rows) editorViewBack(VIEW_MARGIN);
+  editorViewTrim();
+}
+
+/* puts the window at the line starting at offset, line is its number or -1. the cursor goes to it */
+void editorViewAt(size_t offset, long long line){
+  slabRelease(&Editor.slab);
+  rowsFree(&Editor.rows);
+  rowsInit(&Editor.rows);
+  Editor.numrows = 0;
+  Editor.rendered = 0;
+  Editor.render_nrows = 0;
+  Editor.match_row = -1;
+  editorViewReset();
+
+  Editor.view_offset = Editor.map_offset = offset;
+  Editor.view_line = line >= 0 || linesIndexLine(offset, &line) ? line : -1;
+  Editor.cursor_y = Editor.cursor_x = 0;
+  Editor.row_offset = 0;
+  Editor.view_shift = 0;
+  editorLoadUntil(2 * Editor.screen_rows);
+  editorViewBack(VIEW_MARGIN);
+}
+
+/* the row of the line starting at offset, the window moves there when it is not in it */
+int editorViewReach(size_t offset, long long line){
+  if (offset < Editor.view_offset || offset >= Editor.map_offset){
+    editorViewAt(offset, line);
+    return Editor.cursor_y;
+  }
+
+  char *p = Editor.map + offset;
+  int lo = 0, hi = Editor.numrows - 1;
+  while (lo < hi){
+    int mid = (lo + hi + 1) / 2;
+    if (editorRowAt(mid)->chars <= p) lo = mid;
+    else hi = mid - 1;
+  }
+  return lo;
+}
+
+/* where the last line of the mapping starts */
+size_t editorViewLastLine(){
+  char *end = Editor.map + Editor.map_size;
+  if (end[-1] == '\n') end--;
+  char *nl = memrchr(Editor.map, '\n', end - Editor.map);
+  return nl ? (size_t)(nl + 1 - Editor.map) : 0;
+}
+
+/* the line number of filerow, -1 while the viewer does not know it yet */
+long long editorLineNumber(int filerow){
+  if (!Editor.viewer) return filerow;
+  return Editor.view_line >= 0 ? Editor.view_line + filerow : -1;
+}
+
+/* catches up with the index, returns 1 when the screen shows something new */
+int editorViewIdle(){
+  int redraw = 0, done;
+  size_t offset;
+
+  long long count = linesIndexCount(&done);
+  if (count != Editor.view_count){
+    Editor.view_count = count;
+    redraw = 1;
+  }
+  if (Editor.view_line < 0 && linesIndexLine(Editor.view_offset, &Editor.view_line)) redraw = 1;
+  if (Editor.view_goto >= 0 && linesIndexOffset(Editor.view_goto, &offset) != 0){
+    editorGotoLine(Editor.view_goto);
+    redraw = 1;
+  }
+  return redraw;
+}
+
+/*  goto  */
+
+/* moves the cursor to the start of line, counted from 0, and centers it */
+void editorGotoLine(long long line){
+  if (line < 0) line = 0;
+
+  if (Editor.viewer){
+    size_t offset;
+    int found = linesIndexOffset(line, &offset);
+
+    if (found == 0){
+      Editor.view_goto = line;
+      editorSetStatusMessage("Line %lld: indexing...", line + 1);
+      return;
+    }
+    Editor.view_goto = -1;
+    if (found == -1){
+      offset = editorViewLastLine();
+      line = -1;
+    }
+    Editor.cursor_y = editorViewReach(offset, line);
+  } else {
+    if (line >= INT_MAX) line = INT_MAX - 1;
+    editorLoadUntil(line);
+    if (line >= Editor.numrows) line = Editor.numrows > 0 ? Editor.numrows - 1 : 0;
+    Editor.cursor_y = line;
+  }
+
+  Editor.cursor_x = 0;
+  Editor.row_offset = Editor.cursor_y > Editor.screen_rows / 2 ? Editor.cursor_y - Editor.screen_rows / 2 : 0;
+}
+
+/* moves the cursor percent of the way into the file. before the viewer's index is
+   complete that is the line percent of the bytes into the file are in */
+void editorGotoPercent(int percent){
+  int done;
+
+  if (percent > 100) percent = 100;
+  if (!Editor.viewer){
+    editorLoadUntil(INT_MAX);
+    editorGotoLine(((long long)percent * Editor.numrows + 99) / 100 - 1);
+    return;
+  }
+
+  long long count = linesIndexCount(&done);
+  if (done){
+    editorGotoLine((percent * count + 99) / 100 - 1);
+    return;
+  }
+
+  size_t at = Editor.map_size / 100 * percent + Editor.map_size % 100 * percent / 100;
+  size_t offset = editorViewLastLine();
+  if (at < offset){
+    char *nl = memrchr(Editor.map, '\n', at);
+    offset = nl ? (size_t)(nl + 1 - Editor.map) : 0;
+  }
+
+  Editor.view_goto = -1;
+  Editor.cursor_y = editorViewReach(offset, -1);
+  Editor.cursor_x = 0;
+  Editor.row_offset = Editor.cursor_y > Editor.screen_rows / 2 ? Editor.cursor_y - Editor.screen_rows / 2 : 0;
 }
 
 
 /*  output  */
 
 void editorScroll(){
+  editorLoadUntil(Editor.cursor_y + Editor.screen_rows);
+  editorViewKeep();
+
   Editor.render_position_x = 0;
   if (Editor.cursor_y < Editor.numrows){
-    Editor.render_position_x = editorRowCxToRx(&Editor.row[Editor.cursor_y], Editor.cursor_x);
+    Editor.render_position_x = editorRowCxToRx(editorRowMaterialize(Editor.cursor_y), Editor.cursor_x);
   }
 
   if (Editor.cursor_y < Editor.row_offset){
@@ -494,16 +2627,17 @@ void editorScroll(){
   }
 }
 
-int editorDrawLogo(struct abuf *ab){
+/* draws the logo from text row y down, returns the rows it took */
+int editorDrawLogo(int y){
   
   int padding = (Editor.screen_cols - LOGO_WIDTH) / 2;
   if (padding < 0) padding = 0;
   int p = padding;
   if (p) {
-     abAppend(ab, "~", 1);
+     screenAppend("~", 1);
      p--;
   }
-  while (p--) abAppend(ab, " ", 1);
+  while (p--) screenAppend(" ", 1);
 
 
   int rows = 1;
@@ -517,23 +2651,23 @@ int editorDrawLogo(struct abuf *ab){
     if (LOGO[i] == -1){
       rows++;
       current_color = 1;
-      // abAppend(ab, "\x1b[m", 3);
-      abAppend(ab, "\x1b[K", 3);
-      abAppend(ab, "\r\n", 2);
+      screenPen(0, 0, 0);
+      screenNewline();
+      if (y + rows > Editor.screen_rows) break;
       int p = padding;
       if (p) {
-          abAppend(ab, "~", 1);
+          screenAppend("~", 1);
           p--;
       }
-      while (p--) abAppend(ab, " ", 1);
+      while (p--) screenAppend(" ", 1);
       continue;
     }
     if (LOGO[i] >= 0){
-      for (int j = 0; j<LOGO[i]; j++) abAppend(ab, " ", 1);
+      for (int j = 0; j<LOGO[i]; j++) screenAppend(" ", 1);
       if (current_color > 0){
-        abAppend(ab, "\x1b[7m", 4); 
+        screenPen(0, 0, SCREEN_REVERSE);
       } else {
-        abAppend(ab, "\x1b[m", 3);
+        screenPen(0, 0, 0);
       }
       current_color*=-1;
     }
@@ -543,132 +2677,179 @@ int editorDrawLogo(struct abuf *ab){
   return rows;
 }
 
+/*  theme  */
+
+enum themeColor {
+  COLOR_NUMBER = 1,
+  COLOR_CONSTANT,
+  COLOR_STRING,
+  COLOR_KEYWORD,
+  COLOR_DTYPE,
+  COLOR_COMMENT,
+  COLOR_MATCH,
+  COLOR_TEXT,
+  COLOR_GUTTER,
+  COLOR_MODE
+};
+
+/* in themeColor order: the SGR code for 16 color terminals, a 256 color index and rgb */
+const struct screenColor THEME[] = {
+  {33, 178, 215, 175, 0},    // number
+  {93, 228, 255, 255, 135},  // constant
+  {36, 37, 0, 175, 175},     // string
+  {35, 170, 215, 95, 215},   // keyword
+  {32, 71, 95, 175, 95},     // dtype
+  {90, 244, 128, 128, 128},  // comment
+  {34, 33, 0, 135, 255},     // match
+  {37, 252, 208, 208, 208},  // text
+  {90, 242, 108, 108, 108},  // gutter
+  {36, 37, 0, 175, 175},     // mode, behind the status bar's mode
+};
+
 int editorSyntaxToColor(int hl){
   switch (hl){
-    case NUMBER: return 33;
-    case CONSTANT: return 93;
-    case STRING: return 36;
-    case KEYWORD: return 35;
-    case DTYPE: return 32;
+    case NUMBER: return COLOR_NUMBER;
+    case CONSTANT: return COLOR_CONSTANT;
+    case STRING: return COLOR_STRING;
+    case KEYWORD: return COLOR_KEYWORD;
+    case DTYPE: return COLOR_DTYPE;
     
     case MCOM_START:
     case MCOM_END:
-    case COMMENT: return 90;
+    case COMMENT: return COLOR_COMMENT;
+
+    case HL_MATCH: return COLOR_MATCH;
     
-    default: return 37;
+    default: return COLOR_TEXT;
   }
 }
 
-void editorDrawRows(struct abuf *ab) {
+void editorDrawRows() {
+  editorSyntaxCatchUp(Editor.row_offset + Editor.screen_rows);
+
   int y;
   for (y = 0; y < Editor.screen_rows; y++) {
     int filerow = y + Editor.row_offset;
+    screenMove(y, 0);
+    screenPen(0, 0, 0);
     if (filerow >= Editor.numrows){
       if (Editor.numrows == 0 && y == Editor.screen_rows / 4) {
-        y += editorDrawLogo(ab);
-        abAppend(ab, "\x1b[K", 3);
-        abAppend(ab, "\r\n", 2);
+        y += editorDrawLogo(y);
+        if (y >= Editor.screen_rows) break;
+        screenMove(y, 0);
+        screenPen(0, 0, 0);
         char welcome[80];
         int welcomelen = snprintf(welcome, sizeof(welcome),
           "Corvux editor -- version %s", EDITOR_VERSION);
         if (welcomelen > Editor.screen_cols) welcomelen = Editor.screen_cols;
         int padding = (Editor.screen_cols - welcomelen) / 2;
         if (padding) {
-          abAppend(ab, "~", 1);
+          screenAppend("~", 1);
           padding--;
         }
-        while (padding--) abAppend(ab, " ", 1);
-        abAppend(ab, welcome, welcomelen);
+        while (padding--) screenAppend(" ", 1);
+        screenAppend(welcome, welcomelen);
       } else {
-        abAppend(ab, "~", 1);
+        screenAppend("~", 1);
     }
     } else {
-      int len = Editor.row[filerow].render_size - Editor.col_offset;
+      erow *row = editorRowMaterialize(filerow);
+      int len = row->render_size - Editor.col_offset;
 
-      abAppend(ab, "\x1b[90m", 5);
+      screenPen(COLOR_GUTTER, 0, 0);
       char buf[24];
-      int buf_len = snprintf(buf, sizeof(buf), "%d", Editor.row[filerow].idx+1);
+      long long line = editorLineNumber(filerow);
+      int buf_len = line >= 0 ? snprintf(buf, sizeof(buf), "%lld", line + 1) : 0;
       int padding = LEFT_PADDING - buf_len - 1;
-      while (padding--){ abAppend(ab, " ", 1); }
-      abAppend(ab, buf, buf_len);
-      abAppend(ab, " \x1b[m", 4);
+      while (padding-- > 0){ screenAppend(" ", 1); }
+      screenAppend(buf, buf_len);
+      screenAppend(" ", 1);
+      screenPen(0, 0, 0);
 
       if (len < 0) len = 0;
       if (len > Editor.screen_cols) len = Editor.screen_cols;
 
-      char *c = &Editor.row[filerow].render[Editor.col_offset];
-      unsigned char *hl = &Editor.row[filerow].hl[Editor.col_offset];
+      char *c = &row->render[Editor.col_offset];
+      unsigned char *hl = &row->hl[Editor.col_offset];
       int current_hl = PLAIN;
 
-      int j;
-      for (j = 0; j < len; j++){ 
+      int j = 0;
+      while (j < len){
         if (hl[j] != current_hl){
-          int color = editorSyntaxToColor(hl[j]);
-          char buf[16];
-          int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-          abAppend(ab, buf, clen);
+          screenPen(hl[j] == PLAIN ? 0 : editorSyntaxToColor(hl[j]), 0, 0);
           current_hl = hl[j];
         }
-        abAppend(ab, &c[j], 1);
+        int run = j + 1;
+        while (run < len && hl[run] == current_hl) run++;
+        screenAppend(&c[j], run - j);
+        j = run;
       }
-      abAppend(ab, "\x1b[39m", 5);
 
     }
-    abAppend(ab, "\x1b[K", 3);
-    abAppend(ab, "\r\n", 2);
   }
 }
 
-void editorDrawMessageBar(struct abuf *ab){
-  abAppend(ab, "\x1b[K", 3);
+void editorDrawMessageBar(){
+  screenMove(Editor.screen_rows + 1, 0);
+  screenPen(0, 0, 0);
   int msglen = strlen(Editor.statusmsg);
 
   msglen = msglen < Editor.screen_cols ? msglen : Editor.screen_cols; 
-  if (msglen && time(NULL) - Editor.statusmsg_time < 5) abAppend(ab, Editor.statusmsg, msglen);
+  if (msglen && time(NULL) - Editor.statusmsg_time < 5) screenAppend(Editor.statusmsg, msglen);
 }
 
-void editorDrawStatusBar(struct abuf *ab) {
-  // abAppend(ab, "\x1b[7m", 4);
+void editorDrawStatusBar() {
   char status[80], rstatus[80];
   char mstatus[11];
 
-  abAppend(ab, "\x1b[46m", 5);
+  screenMove(Editor.screen_rows, 0);
+  screenPen(0, COLOR_MODE, 0);
   
   int modelen = snprintf(mstatus, sizeof(mstatus), "| %s |", MODES_STRING[Editor.editorMode]);
-  abAppend(ab, mstatus, modelen);
-  // abAppend(ab, " ", 1);
+  screenAppend(mstatus, modelen);
   int cols_left = Editor.screen_cols - modelen - 1; 
 
-  abAppend(ab, "\x1b[m", 3);
-  abAppend(ab, "\x1b[7m", 4);  
-  abAppend(ab, " ", 1);
-  int len = snprintf(status, sizeof(status), "%.20s - %d lines %s", 
-                     Editor.filename ? Editor.filename : "[No Name]", Editor.numrows,
-                     Editor.dirty ? "(*)" : "");
+  screenPen(0, 0, SCREEN_REVERSE);
+  screenAppend(" ", 1);
+  // the viewer counts lines with the index, it has all of them once that is done
+  long long lines = Editor.numrows;
+  int done = Editor.map_offset >= Editor.map_size;
+  if (Editor.viewer) lines = linesIndexCount(&done);
+
+  int len = snprintf(status, sizeof(status), "%.20s - %lld%s lines%s%s", 
+                     Editor.filename ? Editor.filename : "[No Name]", lines,
+                     done ? "" : "+",
+                     Editor.viewer ? " [RO]" : Editor.dirty ? " (*)" : "",
+                     editorCrlf() ? " [CRLF]" : "");
 
   char *syn_type = lexerGetSyntaxName();
-  int rlen = snprintf(rstatus, sizeof(rstatus), "%s ; %d/%d",
-                      syn_type ? syn_type : "[unknown filetype]", Editor.cursor_y+1, Editor.numrows);
+  long long line = editorLineNumber(Editor.cursor_y);
+  int rlen;
+  if (line >= 0){
+    rlen = snprintf(rstatus, sizeof(rstatus), "%s ; %lld/%lld",
+                    syn_type ? syn_type : "[unknown filetype]", line + 1, lines);
+  } else {
+    rlen = snprintf(rstatus, sizeof(rstatus), "%s ; ?/%lld",
+                    syn_type ? syn_type : "[unknown filetype]", lines);
+  }
 
 
   len = len < cols_left ? len : cols_left;
 
-  abAppend(ab, status, len);
+  screenAppend(status, len);
 
   cols_left -= len;
   while(cols_left > 0){
     if (cols_left == rlen){
-      abAppend(ab, rstatus, rlen);
+      screenAppend(rstatus, rlen);
       break;
     } else{
-      abAppend(ab, " ", 1);
+      screenAppend(" ", 1);
       cols_left--;
     }
   }
 
-
-  abAppend(ab, "\x1b[m", 3);
-  abAppend(ab, "\r\n", 2);
+  screenPen(0, 0, 0);
 }
 
 void editorSetStatusMessage(const char *fmt, ...){
@@ -679,8 +2860,181 @@ void editorSetStatusMessage(const char *fmt, ...){
   Editor.statusmsg_time = time(NULL);
 }
 
+/*  frame scheduling  */
+
+/*
+  Handling a key only marks the screen stale. The frame is drawn once no
+  more input is waiting and no sooner than 1000 / fps ms after the last
+  one. Every frame ends with a status request (ESC[5n), and the next one
+  waits for the terminal's answer, up to FRAME_STALL_MS: a slow terminal
+  or link then has one frame in flight rather than a backlog of them, and
+  the keys that arrive meanwhile all go into the next. A steady stream of
+  keys still gets a frame every FRAME_LAG_MS.
+*/
+
+struct frameClock {
+  int fps;          // 0 for no limit
+  int stale;        // the screen no longer shows the editor's state
+  long long last;   // when the last frame was drawn, in ms
+  int sync;         // frames wait for the terminal, cleared when it never answers
+  int unanswered;   // requests the terminal has not answered yet
+  int answers;
+  int timeouts;     // frames that stopped waiting before the terminal ever answered
+} Frames = {FRAME_RATE, 1, 0, 1, 0, 0, 0};
+
+long long editorNow(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* the terminal answered the request after the last frame, it has shown it */
+void editorFrameShown(){
+  if (Frames.unanswered > 0) Frames.unanswered--;
+  Frames.answers++;
+}
+
+/* draws a stale screen when a frame is due, returns the ms until one is or -1 when none is needed */
+int editorFrameSchedule(){
+  if (!Frames.stale) return -1;
+
+  long long elapsed = editorNow() - Frames.last;
+  long long wait = Frames.fps > 0 ? 1000 / Frames.fps - elapsed : 0;
+  int late = Frames.unanswered > 0;
+  if (late && elapsed < FRAME_STALL_MS && FRAME_STALL_MS - elapsed > wait) wait = FRAME_STALL_MS - elapsed;
+  if (wait > 0) return wait;
+
+  if (late){
+    // waited the full FRAME_STALL_MS: a terminal that never answered stops being asked,
+    // one that did is taken to have lost the answer and the count starts over
+    if (Frames.answers == 0 && ++Frames.timeouts == FRAME_SYNC_TRIES) Frames.sync = 0;
+    Frames.unanswered = 0;
+  }
+
+  editorRefreshScreen();
+  return -1;
+}
+
 /*  input  */
 
+/* keys are read from here, filled a chunk at a time so that everything
+   typed or pasted while a frame was drawn is handled before the next */
+struct inputBuf {
+  char buf[INPUT_CHUNK];
+  int pos, len;
+} Input;
+
+/* waits up to timeout ms, -1 for ever, for input and reads what has arrived. returns 1 when
+   there is input to take. a wait also ends when the highlighting worker finishes a job */
+int editorInputWait(int timeout){
+  struct pollfd fds[2];
+  int nfds = 1;
+
+  if (Input.pos < Input.len) return 1;
+
+  fds[0].fd = STDIN_FILENO;
+  fds[0].events = POLLIN;
+  if (timeout != 0 && HlWorker.started == 1){
+    fds[1].fd = HlWorker.done[0];
+    fds[1].events = POLLIN;
+    nfds = 2;
+  }
+
+  if (poll(fds, nfds, timeout) == -1){
+    if (errno == EINTR) return 0;
+    die("poll");
+  }
+  if (nfds == 2 && fds[1].revents){
+    char drain[64];
+    while (read(HlWorker.done[0], drain, sizeof(drain)) > 0);
+  }
+  if (fds[0].revents == 0) return 0;
+
+  ssize_t nread = read(STDIN_FILENO, Input.buf, sizeof(Input.buf));
+  if (nread == -1 && errno != EAGAIN && errno != EINTR) die("read");
+  if (nread == 0 && (fds[0].revents & POLLHUP)) die("read");
+  if (nread <= 0) return 0;
+
+  Input.pos = 0;
+  Input.len = nread;
+  return 1;
+}
+
+int editorInputByte(int timeout, char *c){
+  if (!editorInputWait(timeout)) return 0;
+  *c = Input.buf[Input.pos++];
+  return 1;
+}
+
+/* takes in the answers to frames still out before the editor quits, the shell would get them */
+void editorFrameDrain(){
+  long long until = editorNow() + FRAME_STALL_MS;
+  char c;
+
+  while (Frames.unanswered > 0 && editorNow() < until){
+    if (editorInputByte(until - editorNow(), &c) && c == 'n') Frames.unanswered--;
+  }
+}
+
+/* the text of the last bracketed paste */
+struct pasteBuf {
+  char *s;
+  size_t len, cap;
+} Paste;
+
+/* reads a paste up to the ESC[201~ the terminal ends it with, after the ESC[200~ that started it.
+   the answer to a frame's status request can land in the middle of a long paste, it is taken out */
+int editorReadPaste(){
+  static const char end[] = "\x1b[201~", shown[] = "\x1b[0n";
+  size_t matched = 0;
+  char c;
+
+  Paste.len = 0;
+  while (matched < sizeof(end) - 1){
+    if (!editorInputByte(-1, &c)) continue;
+    if (Paste.len == Paste.cap){
+      Paste.cap = Paste.cap ? Paste.cap * 2 : 4096;
+      Paste.s = realloc(Paste.s, Paste.cap);
+      if (Paste.s == NULL) die("realloc");
+    }
+    Paste.s[Paste.len++] = c;
+    matched = c == end[matched] ? matched + 1 : c == end[0];
+
+    size_t n = sizeof(shown) - 1;
+    if (c == 'n' && Paste.len >= n && !memcmp(&Paste.s[Paste.len - n], shown, n)){
+      Paste.len -= n;
+      editorFrameShown();
+    }
+  }
+  Paste.len -= sizeof(end) - 1;
+  return PASTE;
+}
+
+/* input is waiting, the screen can be drawn once it has all been handled */
+int editorInputPending(){
+  return editorInputWait(0);
+}
+
+/* does a slice of background work and draws a frame when one is due, returns how long to wait
+   for input before the next: 0 while work is left, else until the next frame, -1 for no limit */
+int editorIdle(){
+  if (MapGuard.hit){
+    MapGuard.hit = 0;
+    editorSetStatusMessage("%.20s was cut short on disk, past %zu bytes it reads as NUL bytes", Editor.filename, MapGuard.lost);
+    Frames.stale = 1;
+  }
+
+  int more = editorLoadIdle(), done = 1;
+  if (editorSyntaxIdle()) Frames.stale = 1;
+  if (Editor.viewer && editorViewIdle()) Frames.stale = 1;
+  int wait = editorFrameSchedule();
+  if (more || editorSyntaxReady()) return 0;
+
+  // the status bar follows the index while it is built
+  if (Editor.viewer) linesIndexCount(&done);
+  return !done && (wait == -1 || wait > VIEW_POLL_MS) ? VIEW_POLL_MS : wait;
+}
+
 char *editorPrompt(char *prompt, void (*callback)(char *, int)){
   size_t bufsize = 128;
   char *buf = malloc(bufsize);
@@ -689,7 +3043,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)){
   buf[0] = '\0';
   while(1){
     editorSetStatusMessage(prompt, buf);
-    editorRefreshScreen();
+    Frames.stale = 1;
 
     int c = editorReadKey();
     if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE){
@@ -705,6 +3059,17 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)){
         if (callback) callback(buf, c);
         return buf;
       }
+    } else if (c == PASTE) {
+      // the first line of a paste goes into the prompt
+      for (size_t i = 0; i < Paste.len && Paste.s[i] != '\r' && Paste.s[i] != '\n'; i++){
+        if (iscntrl(Paste.s[i])) continue;
+        if (buflen == bufsize - 1) {
+          bufsize *= 2;
+          buf = realloc(buf, bufsize);
+        }
+        buf[buflen++] = Paste.s[i];
+      }
+      buf[buflen] = '\0';
     } else if (!iscntrl(c) && c < 128) {
       if (buflen == bufsize - 1) {
         bufsize *= 2;
@@ -719,28 +3084,42 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)){
 }
 
 int editorReadKey(){
-  int nread;
   char c;
-  while ((nread = read(STDIN_FILENO, &c, 1)) != 1){
-    if (nread == -1 && errno != EAGAIN) die("read");
-  }
+  int timeout = 0;
+  while (!editorInputByte(timeout, &c)) timeout = editorIdle();
 
   if (c == '\x1b') {
     char seq[3];
-    if (read(STDIN_FILENO, &seq[0], 1) != 1) return ESCAPE;
-    if (read(STDIN_FILENO, &seq[1], 1) != 1) return ESCAPE;
+    if (!editorInputByte(INPUT_WAIT_MS, &seq[0])) return ESCAPE;
+    if (seq[0] == '\x1b'){
+      // a lone Esc, the next one starts a sequence of its own, often the answer to a frame
+      Input.pos--;
+      return ESCAPE;
+    }
+    if (!editorInputByte(INPUT_WAIT_MS, &seq[1])) return ESCAPE;
     if (seq[0] == '[') {
       if (seq[1] >= '0' && seq[1] <= '9'){
-        if (read(STDIN_FILENO, &seq[2], 1) != 1) return ESCAPE;
+        int num = seq[1] - '0';
+        while (1){
+          if (!editorInputByte(INPUT_WAIT_MS, &seq[2])) return ESCAPE;
+          if (seq[2] < '0' || seq[2] > '9' || num > 999) break;
+          num = num * 10 + seq[2] - '0';
+        }
+        if (seq[2] == 'n' && num == 0){
+          // the terminal's answer to the request after a frame, not a key
+          editorFrameShown();
+          return editorReadKey();
+        }
         if (seq[2] == '~'){
-          switch (seq[1]) {
-            case '1': return HOME_KEY;
-            case '3': return DEL_KEY;
-            case '4': return END_KEY;
-            case '5': return PAGE_UP;
-            case '6': return PAGE_DOWN;
-            case '7': return HOME_KEY;
-            case '8': return END_KEY;
+          switch (num) {
+            case 1: return HOME_KEY;
+            case 3: return DEL_KEY;
+            case 4: return END_KEY;
+            case 5: return PAGE_UP;
+            case 6: return PAGE_DOWN;
+            case 7: return HOME_KEY;
+            case 8: return END_KEY;
+            case 200: return editorReadPaste();
           }
         }
       } else{
@@ -773,7 +3152,7 @@ int getCursorPosition(int *rows, int *cols) {
   if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) return -1;
 
   while (i < sizeof(buf) - 1) {
-    if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
+    if (!editorInputByte(INPUT_WAIT_MS, &buf[i])) break;
     if (buf[i] == 'R') break;
     i++;
   }
@@ -799,7 +3178,7 @@ int getWindowSize(int *rows, int *cols){
 }
 
 void editorMoveCursor(int key){
-  erow *row = (Editor.cursor_y >= Editor.numrows) ? NULL : &Editor.row[Editor.cursor_y];
+  erow *row = (Editor.cursor_y >= Editor.numrows) ? NULL : editorRowAt(Editor.cursor_y);
 
   switch (key){
     case ARROW_LEFT:
@@ -807,7 +3186,7 @@ void editorMoveCursor(int key){
         Editor.cursor_x--;
       } else if (Editor.cursor_y > 0){
         Editor.cursor_y--;
-        Editor.cursor_x = Editor.row[Editor.cursor_y].size;
+        Editor.cursor_x = editorRowAt(Editor.cursor_y)->size;
       }
       break;
     case ARROW_DOWN:
@@ -825,7 +3204,7 @@ void editorMoveCursor(int key){
       }
       break;
   }
-  row = (Editor.cursor_y >= Editor.numrows) ? NULL : &Editor.row[Editor.cursor_y];
+  row = (Editor.cursor_y >= Editor.numrows) ? NULL : editorRowAt(Editor.cursor_y);
   int rowlen = row ? row->size : 0;
   if (Editor.cursor_x > rowlen){
     Editor.cursor_x = rowlen;
@@ -876,6 +3255,26 @@ void editorProcessCommand(char *command, int c){
     editorSave(token);
   }
 
+  // :N goes to line N, :N% that far into the file
+  if (isdigit((unsigned char)command_token[0])){
+    if (command_token[strlen(command_token) - 1] == '%') editorGotoPercent(atoi(command_token));
+    else editorGotoLine(atoll(command_token) - 1);
+  }
+
+  if (!strcmp(command_token, "fps")){
+    token = strtok(NULL, " ");
+    if (token != NULL && atoi(token) >= 0) Frames.fps = atoi(token);
+    if (Frames.fps) editorSetStatusMessage("%d frames a second at most", Frames.fps);
+    else editorSetStatusMessage("no frame rate limit");
+  }
+
+  // :undolimit N keeps N KB of undo history, trimmed as the next edit is recorded
+  if (!strcmp(command_token, "undolimit")){
+    token = strtok(NULL, " ");
+    if (token != NULL && atoi(token) > 0) Editor.undo.limit = (size_t)atoi(token) << 10;
+    editorSetStatusMessage("undo history up to %zu KB", Editor.undo.limit >> 10);
+  }
+
   if (strchr(command_token, 'q')){
     if (!Editor.dirty || strchr(token, '!')){
       command = realloc(command, 2);
@@ -940,15 +3339,36 @@ int editorProcessNormalMode(int c){
 
     case 'i':
     case 'a':
-      if (Editor.row != NULL && c == 'a' && Editor.cursor_x < Editor.row[Editor.cursor_y].size) editorMoveCursor(ARROW_RIGHT);
+      if (editorReadOnly()) break;
+      if (Editor.cursor_y < Editor.numrows && c == 'a' && Editor.cursor_x < editorRowAt(Editor.cursor_y)->size) editorMoveCursor(ARROW_RIGHT);
       Editor.editorMode = INSERT;
       break;
     
     case 'o':
+      if (editorReadOnly()) break;
       editorInsertNewline();
       Editor.editorMode = INSERT;
       break;
 
+    case 'u':
+      editorUndo();
+      break;
+
+    case '/':
+      Editor.editorMode = COMMND;
+      editorFind();
+      Editor.editorMode = NORMAL;
+      break;
+
+    case 'n':
+    case 'N':
+      editorFindNext(c == 'n' ? 1 : -1);
+      break;
+
+    case CTRL_KEY('r'):
+      editorRedo();
+      break;
+
     case CTRL_KEY('s'):
       editorSave(NULL);
       break;
@@ -991,20 +3411,30 @@ int editorProcessInsertMode(int c){
 int editorProcessKeypress(){
   int c = editorReadKey();
 
+  editorSearchClear();
+  editorLoadUntil(Editor.row_offset + 2 * Editor.screen_rows);
+  editorViewKeep();
+
   switch (c) {
     case CTRL_KEY('x'):
     case ESCAPE:
       Editor.editorMode = NORMAL;
+      undoBreak(&Editor.undo);
       return 0;
     case ARROW_LEFT:
     case ARROW_DOWN:
     case ARROW_UP:
     case ARROW_RIGHT:
       editorMoveCursor(c);
+      undoBreak(&Editor.undo);
+      return 0;
+    case PASTE:
+      editorPaste(Paste.s, Paste.len);
       return 0;
     case PAGE_UP:
     case PAGE_DOWN:
       {
+        undoBreak(&Editor.undo);
         if (c == PAGE_UP){
           Editor.cursor_y = Editor.row_offset;
         } else if (c == PAGE_DOWN){
@@ -1020,6 +3450,8 @@ int editorProcessKeypress(){
 
   switch (Editor.editorMode) {
     case NORMAL:
+      // every command in normal mode is undone on its own, a stay in insert mode as a whole
+      undoBreak(&Editor.undo);
       return editorProcessNormalMode(c);
     case INSERT:
       return editorProcessInsertMode(c);
@@ -1029,27 +3461,59 @@ int editorProcessKeypress(){
 }
 
 void editorFree(){
-  int i;
-  for (i = 0; i < Editor.numrows; i++){
-    editorFreeRow(&Editor.row[i]);
-  }
-  free(Editor.row);
+  // the rows' text, renders and hl all go with the slab
+  slabRelease(&Editor.slab);
+  rowsFree(&Editor.rows);
+  undoFree(&Editor.undo);
+  searchFree(&Editor.search);
+  free(Editor.render_rows);
+  Editor.render_rows = NULL;
+  Editor.render_cap = 0;
   free(Editor.filename);
+  Editor.filename = NULL;
+
+  // the index reads the mapping until it is stopped
+  linesIndexStop();
+  if (Editor.map != NULL){
+    munmap(Editor.map, Editor.map_len);
+    close(Editor.map_fd);
+  }
+  Editor.map = NULL;
+  Editor.map_size = Editor.map_offset = Editor.map_len = 0;
 }
 
 void editorClearCmdBuf(){
   for(int i = 0; i < sizeof(Editor.command_buf); i++){ Editor.command_buf[i] = 0; }
 }
 
-void initEditor(){
+/* resets the editor for a window of the given size, without asking the terminal */
+void initEditorSize(int rows, int cols){
+  editorFree();
+
   Editor.cursor_x = 0;
   Editor.cursor_y = 0;
   Editor.render_position_x = 0;
   Editor.numrows = 0;
-  Editor.row = NULL;
+  Editor.rendered = 0;
+  Editor.render_nrows = 0;
+  rowsInit(&Editor.rows);
+  // a limit set with :undolimit outlives the file
+  undoInit(&Editor.undo, Editor.undo.limit ? Editor.undo.limit : UNDO_LIMIT);
+  Editor.undo_paused = 0;
+  Editor.match_row = -1;
+  Editor.hl_npending = 0;
+  Editor.hl_frontier = 0;
+  Editor.hl_epoch++;
+  Editor.eol_lf = Editor.eol_crlf = 0;
+  Editor.viewer = 0;
+  Editor.view_offset = 0;
+  Editor.view_line = -1;
+  Editor.view_goto = -1;
+  Editor.view_count = 0;
   Editor.editorMode = NORMAL;
   Editor.dirty = 0;
   Editor.row_offset = 0;
+  Editor.view_shift = 0;
   Editor.col_offset = 0;
   Editor.filename = NULL;
 
@@ -1058,37 +3522,67 @@ void initEditor(){
   Editor.statusmsg[0] = '\0';
   Editor.statusmsg_time = 0;
 
-  if (getWindowSize(&Editor.screen_rows, &Editor.screen_cols) == -1) die("getWindowSize");
-  Editor.screen_rows -= 2;
+  Editor.screen_rows = rows - 2;
+  Editor.screen_cols = cols;
+  screenTheme(THEME, sizeof(THEME) / sizeof(THEME[0]), screenColorDepth());
+  screenInvalidate();
+  Frames.stale = 1;
+}
+
+void initEditor(){
+  int rows, cols;
+  if (getWindowSize(&rows, &cols) == -1) die("getWindowSize");
+  initEditorSize(rows, cols);
 }
 
 void editorRefreshScreen(){
-  struct abuf ab = ABUF_INIT;
+  static int cursor_shape = 0;
+  static long long drawn_row = 0;
+  static int drawn_col = 0;
+  static struct abuf ab = ABUF_INIT;
+
+  abReset(&ab);
+  Editor.frame++;
+  Frames.stale = 0;
+  Frames.last = editorNow();
 
   editorScroll();
 
+  screenBegin(Editor.screen_rows + 2, Editor.screen_cols);
+  // the text area scrolls in the terminal, the status bars below it stay
+  // the viewer's rows are counted from its window, view_shift keeps that in step
+  long long top = Editor.view_shift + Editor.row_offset;
+  if (Editor.col_offset == drawn_col && top - drawn_row >= -Editor.screen_rows && top - drawn_row <= Editor.screen_rows){
+    screenScroll(0, Editor.screen_rows, top - drawn_row);
+  }
+  drawn_row = top;
+  drawn_col = Editor.col_offset;
+  editorDrawRows();
+  editorDrawStatusBar();
+  editorDrawMessageBar();
+
   abAppend(&ab, "\x1b[?25l", 6); // hide cursor
-  abAppend(&ab, "\x1b[H", 3); // cursor to the start
-  
-  editorDrawRows(&ab);
-  editorDrawStatusBar(&ab);
-  editorDrawMessageBar(&ab);
+  screenFlush(&ab);
+  if (ab.len == 6) ab.len = 0; // nothing changed, the cursor can stay visible
 
-  char buf[32];
-  snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (Editor.cursor_y - Editor.row_offset) + 1,
-                                            (Editor.render_position_x - Editor.col_offset) + 1);
-  abAppend(&ab, buf, strlen(buf));
+  int hidden = ab.len > 0;
+  screenCursor(&ab, Editor.cursor_y - Editor.row_offset,
+                    Editor.render_position_x - Editor.col_offset);
 
-  abAppend(&ab, "\x1b[?25h", 6); // show cursor
+  if (hidden) abAppend(&ab, "\x1b[?25h", 6); // show cursor
 
-  if (Editor.editorMode == INSERT) {
-    abAppend(&ab, "\x1b[\x36 q", 5);
-  } else {
-    abAppend(&ab, "\x1b[\x32 q", 5);
+  int shape = Editor.editorMode == INSERT ? 6 : 2;
+  if (shape != cursor_shape) {
+    abAppend(&ab, shape == 6 ? "\x1b[\x36 q" : "\x1b[\x32 q", 5);
+    cursor_shape = shape;
   }
 
-  write(STDOUT_FILENO, ab.b, ab.len);
-  abFree(&ab);
+  // the status request goes out in the same write, counted once it has
+  int ask = Frames.sync && ab.len > 0;
+  if (ask) abAppend(&ab, "\x1b[5n", 4);
+  if (ab.len && abWrite(&ab, STDOUT_FILENO) != -1 && ask) Frames.unanswered++;
+
+  editorRenderEvict();
 }
 
 int mainLoop(){
@@ -1096,13 +3590,16 @@ int mainLoop(){
   // editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-O = open | Ctrl-N = new file | Ctrl-Q = quit");
 
   while(1){
-    editorRefreshScreen();
+    // the frame is drawn once the keys already waiting are handled, see editorFrameSchedule
     int ret = editorProcessKeypress();
     if (ret == -1){
+      editorFrameDrain();
       write(STDOUT_FILENO, "\x1b[2J", 4);
       write(STDOUT_FILENO, "\x1b[H", 3);
       break;
     }
+    Frames.stale = 1;
+    if (editorNow() - Frames.last >= FRAME_LAG_MS) editorFrameSchedule();
   }
 
   return 0;
@@ -1,6 +1,29 @@
 #ifndef editor
+  #include <stddef.h>
+  #include "rows.h"
+
   int mainLoop();
   void initEditor();
+  void initEditorSize(int rows, int cols);
   void editorFree();
   void editorOpen(char *filename);
+  void editorView(char *filename);
+  void editorSave(char *filename);
+  void editorRefreshScreen();
+
+  /* core operations, also driven directly by the benchmarks and tests */
+  int editorNumRows();
+  erow *editorRowAt(int at);
+  void editorSetCursor(int y, int x);
+  void editorLoadUntil(int filerow);
+  void editorGotoLine(long long line);
+  void editorInsertRow(char *s, int at, size_t len);
+  void editorDeleteRow(int at);
+  void editorRowInsertChar(int filerow, int at, int c);
+  void editorRowDeleteChar(int filerow, int at);
+  void editorUpdateRow(int filerow);
+  void editorUpdateSyntax(int filerow);
+  int editorSyntaxIdle();
+  int editorSyntaxFrontier();
+  int editorReadKey();
 #endif // !DEBUG
@@ -1,27 +1,74 @@
+#define _DEFAULT_SOURCE
+
 #include "lexer.h"
-#include <ctype.h>
+#include "errors.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #define HL_HIGHLIGHT_NUMBERS   (1<<0)
 #define HL_HIGHLIGHT_STRINGS   (1<<1)
 #define HL_HIGHLIGHT_CONSTANTS (1<<2)
 
+#define CH_DIGIT (1<<0)
+#define CH_UPPER (1<<1)
+#define CH_CONST (1<<2)
+
+#define SEPARATOR 0xff
+
+#ifndef SYNTAX_DIR
+#define SYNTAX_DIR "/usr/local/share/corvux/syntax"
+#endif
+
+/*
+  A syntax is compiled the first time a file of its type is opened.
+  Comment markers and separators become a trie over byte classes, so
+  the scan only stops at bytes that can start one of them. Keywords and
+  types go into a collision free hash table.
+*/
+struct syntaxTables {
+  unsigned char cls[256];     // byte class, 0 for bytes no marker uses
+  unsigned char stop[256];    // byte starts a marker or a string
+  unsigned char single[256];  // token ended by a one byte marker nothing longer starts with
+  int nclasses;
+  int nstates;
+  int longest;                // longest marker, how far past a token the scan may look
+  short *trans;               // trans[state * nclasses + class], 0 for no move
+  unsigned char *accept;      // token a state ends, or 0
+  short *prio;                // position of that marker in the rules
+
+  struct tokenMap *words;
+  int nwords;
+  unsigned short *slots;      // word index + 1, 0 for empty
+  unsigned int mask;
+  unsigned int seed;
+  unsigned int lengths;       // bit n set when some word has length n
+  unsigned char first[256];   // byte starts some word
+};
+
 struct syntaxRules{
   char *filetype;
   char **extensions;
   char **separators;
-  int (*get_token_type)(char *token, int token_len, int flags);
+  char **keywords;
+  char **dtypes;
   char *singleline_comment_start;
   char *multiline_comment_start;
   char *multiline_comment_end;
   int flags;
+  struct syntaxTables *tables;
 };
 
 typedef struct lexer{
   char *input;
   int len;
   int pos;
+  int reach;  // end of what the scan for the last token read
   struct syntaxRules *syntax;
 } lexer;
 
@@ -42,11 +89,190 @@ char *C_HL_dtypes[] = {
 };
 
 char *C_HL_separators[] = {
-  " ", ".", ",", "->", ";", ":", "(", ")", "[", "]", "{", "}", 
+  " ", ".", ",", "->", ";", ":", "(", ")", "[", "]", "{", "}",
   "=", "<", ">", NULL
 };
 
-int C_GET_TOKEN_TYPE(char *token, int token_len, int flags){
+
+struct syntaxRules SXDB[] = {
+  {
+    "c",
+    C_HL_extensions,
+    C_HL_separators,
+    C_HL_keywords,
+    C_HL_dtypes,
+    "//",
+    "/*", "*/",
+    HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS | HL_HIGHLIGHT_CONSTANTS,
+    NULL,
+  },
+};
+
+#define SXDB_ENTRIES (sizeof(SXDB) / sizeof(SXDB[0]))
+
+struct syntaxSlot {
+  char *extension;
+  struct syntaxRules *rules;
+};
+
+struct syntaxRegistry {
+  int loaded;
+  struct syntaxSlot *slots;   // open addressing on the extension
+  unsigned int mask;
+  int n;
+} Registry;
+
+// every thread lexes with its own cursor, the compiled tables are shared read only
+__thread lexer Lexer;
+unsigned char CHAR_CLASS[256];
+
+/*  syntax compilation  */
+
+static unsigned int lexerHash(unsigned int seed, const char *s, int len){
+  unsigned int h = seed ^ (unsigned int)len;
+  for (int i = 0; i < len; i++){
+    h = (h ^ (unsigned char)s[i]) * 16777619u;
+  }
+  return h ^ (h >> 15);
+}
+
+/* looks for a seed that puts every word in its own slot, growing the table when none does */
+static void lexerBuildWordTable(struct syntaxTables *t){
+  unsigned int size = 4;
+  while (size < (unsigned int)t->nwords * 2) size <<= 1;
+
+  for (;; size <<= 1){
+    t->slots = realloc(t->slots, sizeof(unsigned short) * size);
+    if (t->slots == NULL) die("realloc");
+    t->mask = size - 1;
+    for (t->seed = 1; t->seed < 256; t->seed++){
+      memset(t->slots, 0, sizeof(unsigned short) * size);
+      int i;
+      for (i = 0; i < t->nwords; i++){
+        unsigned int h = lexerHash(t->seed, t->words[i].token, strlen(t->words[i].token)) & t->mask;
+        if (t->slots[h]) break;
+        t->slots[h] = i + 1;
+      }
+      if (i == t->nwords) return;
+    }
+  }
+}
+
+static void lexerAddWords(struct syntaxTables *t, char **list, int type){
+  for (int i = 0; list && list[i]; i++){
+    int len = strlen(list[i]);
+    int dup = 0;
+    for (int j = 0; j < t->nwords; j++){
+      if (!strcmp(t->words[j].token, list[i])) dup = 1;
+    }
+    if (dup || len == 0) continue;
+
+    t->words = realloc(t->words, sizeof(struct tokenMap) * (t->nwords + 1));
+    if (t->words == NULL) die("realloc");
+    t->words[t->nwords].token = list[i];
+    t->words[t->nwords].type = type;
+    t->nwords++;
+    t->lengths |= len < 32 ? 1u << len : 1u << 31;
+    t->first[(unsigned char)list[i][0]] = 1;
+  }
+}
+
+static void lexerAddMarker(struct syntaxTables *t, char *marker, int kind, int prio){
+  if (marker == NULL || marker[0] == '\0') return;
+
+  int state = 0;
+  for (int i = 0; marker[i]; i++){
+    int c = t->cls[(unsigned char)marker[i]];
+    int next = t->trans[state * t->nclasses + c];
+    if (next == 0){
+      next = t->nstates++;
+      t->trans[state * t->nclasses + c] = next;
+    }
+    state = next;
+  }
+
+  if (t->accept[state] == 0 || prio < t->prio[state]){
+    t->accept[state] = kind;
+    t->prio[state] = prio;
+  }
+}
+
+static struct syntaxTables *lexerCompile(struct syntaxRules *s){
+  struct syntaxTables *t = calloc(1, sizeof(struct syntaxTables));
+  if (t == NULL) die("calloc");
+
+  char *markers[3] = {
+    s->singleline_comment_start, s->multiline_comment_start, s->multiline_comment_end
+  };
+  int kinds[3] = {COMMENT, MCOM_START, MCOM_END};
+
+  int nmarkers = 3, total = 0;
+  for (int i = 0; s->separators && s->separators[i]; i++) nmarkers++;
+
+  // every byte used by a marker gets its own class
+  t->nclasses = 1;
+  for (int m = 0; m < nmarkers; m++){
+    char *mk = m < 3 ? markers[m] : s->separators[m - 3];
+    if (mk == NULL || mk[0] == '\0') continue;
+    t->stop[(unsigned char)mk[0]] = 1;
+    for (int i = 0; mk[i]; i++, total++){
+      if (t->cls[(unsigned char)mk[i]] == 0) t->cls[(unsigned char)mk[i]] = t->nclasses++;
+    }
+    if ((int)strlen(mk) > t->longest) t->longest = strlen(mk);
+  }
+  t->stop['\"'] = 1;
+
+  t->nstates = 1;
+  t->trans = calloc((total + 1) * t->nclasses, sizeof(short));
+  t->accept = calloc(total + 1, 1);
+  t->prio = calloc(total + 1, sizeof(short));
+  if (t->trans == NULL || t->accept == NULL || t->prio == NULL) die("calloc");
+
+  for (int m = 0; m < nmarkers; m++){
+    if (m < 3) lexerAddMarker(t, markers[m], kinds[m], m);
+    else lexerAddMarker(t, s->separators[m - 3], SEPARATOR, m);
+  }
+
+  for (int c = 0; c < 256; c++){
+    int state = t->cls[c] ? t->trans[t->cls[c]] : 0;
+    if (state == 0 || !t->accept[state]) continue;
+    int leaf = 1;
+    for (int k = 0; k < t->nclasses; k++){
+      if (t->trans[state * t->nclasses + k]) leaf = 0;
+    }
+    if (leaf) t->single[c] = t->accept[state];
+  }
+
+  lexerAddWords(t, s->dtypes, DTYPE);
+  lexerAddWords(t, s->keywords, KEYWORD);
+  lexerBuildWordTable(t);
+
+  return t;
+}
+
+/* longest marker starting at s in rules order, returns its length and kind */
+static int lexerMatch(struct syntaxTables *t, const char *s, int len, int *kind){
+  int state = 0, best_len = 0, best_prio = INT_MAX;
+
+  for (int i = 0; i < len; i++){
+    int c = t->cls[(unsigned char)s[i]];
+    if (c == 0) break;
+    state = t->trans[state * t->nclasses + c];
+    if (state == 0) break;
+    if (t->accept[state] && t->prio[state] < best_prio){
+      best_prio = t->prio[state];
+      best_len = i + 1;
+      *kind = t->accept[state];
+    }
+  }
+
+  return best_len;
+}
+
+static int lexerTokenType(char *token, int token_len){
+  struct syntaxTables *t = Lexer.syntax->tables;
+  int flags = Lexer.syntax->flags;
+
   if (token == NULL || token_len == 0) return 0;
 
   if (flags & HL_HIGHLIGHT_STRINGS){
@@ -54,59 +280,234 @@ int C_GET_TOKEN_TYPE(char *token, int token_len, int flags){
       return STRING;
     }
   }
-  
-  for (int i = 0; C_HL_dtypes[i]; i++){
-    if (token_len != (int)strlen(C_HL_dtypes[i])) continue;
-    if (!strncmp(token, C_HL_dtypes[i], token_len)){
-      return DTYPE;
-    }
-  } 
 
-  for (int i = 0; C_HL_keywords[i]; i++){
-    if (token_len != (int)strlen(C_HL_keywords[i])) continue;
-    if (!strncmp(token, C_HL_keywords[i], token_len)){
-      return KEYWORD;
+  if (t->first[(unsigned char)token[0]] && (t->lengths & (token_len < 32 ? 1u << token_len : 1u << 31))){
+    int slot = t->slots[lexerHash(t->seed, token, token_len) & t->mask];
+    if (slot){
+      struct tokenMap *w = &t->words[slot - 1];
+      if (!strncmp(w->token, token, token_len) && w->token[token_len] == '\0') return w->type;
     }
   }
 
   if (flags & HL_HIGHLIGHT_NUMBERS){
-    for (int i = 0; i < token_len; i++){
-      if (i == 0 && token[i] == '-') continue;
-      if (!isdigit(token[i])) break;
-      if (i == token_len-1){
-        return NUMBER;
-      }
-    }
+    int i = token[0] == '-' ? 1 : 0;
+    while (i < token_len && (CHAR_CLASS[(unsigned char)token[i]] & CH_DIGIT)) i++;
+    if (i == token_len && token_len > (token[0] == '-')) return NUMBER;
   }
 
   if (flags & HL_HIGHLIGHT_CONSTANTS){
-    for (int i = 0; i < token_len; i++){
-      if (!isdigit(token[i]) && token[i] != '_' && !isupper(token[i])){break;}
-      if (i == token_len-1) return CONSTANT;
-    }
-
+    int i = 0;
+    while (i < token_len && (CHAR_CLASS[(unsigned char)token[i]] & CH_CONST)) i++;
+    if (i == token_len) return CONSTANT;
   }
-  // if (token_len==4 && !strncmp(token, "NULL", 4)) return NUMBER;
 
   return PLAIN;
 };
 
 
-struct syntaxRules SXDB[] = {
-  {
-    "c",
-    C_HL_extensions,
-    C_HL_separators,
-    C_GET_TOKEN_TYPE,
-    "//",
-    "/*", "*/",
-    HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS | HL_HIGHLIGHT_CONSTANTS,
-  },
-};
+/*  language registry  */
+
+/*
+  Besides the built in table, languages are read from the *.syntax files
+  in SYNTAX_DIR and then in ~/.config/corvux/syntax, the first time a
+  file is opened. A definition is made of lines, each a key and the
+  words that go with it:
+
+    filetype python
+    extensions .py .pyw
+    keywords def class if elif else return
+    types int str float
+    separators \s . , ( ) : =
+    comment #
+    comment-block <start> <end>
+    highlight numbers strings constants
+
+  Words are split on blanks, \s stands for a space and \\ for a
+  backslash, lines whose key starts with # are skipped. Every extension
+  goes into a hash index, a later definition taking it over from an
+  earlier one. A language is kept as its rules until a file of its type
+  opens and its tables are compiled.
+*/
+
+static void lexerIndexPut(char *extension, struct syntaxRules *s){
+  if (Registry.slots == NULL || (unsigned int)(Registry.n + 1) * 2 > Registry.mask + 1){
+    struct syntaxSlot *old = Registry.slots;
+    unsigned int size = old ? (Registry.mask + 1) * 2 : 64;
+    Registry.slots = calloc(size, sizeof(struct syntaxSlot));
+    if (Registry.slots == NULL) die("calloc");
+    Registry.mask = size - 1;
+    Registry.n = 0;
+    for (unsigned int i = 0; old && i < size / 2; i++){
+      if (old[i].extension) lexerIndexPut(old[i].extension, old[i].rules);
+    }
+    free(old);
+  }
 
-#define SXDB_ENTRIES (sizeof(SXDB) / sizeof(SXDB[0]))
+  unsigned int h = lexerHash(0, extension, strlen(extension)) & Registry.mask;
+  while (Registry.slots[h].extension && strcmp(Registry.slots[h].extension, extension)){
+    h = (h + 1) & Registry.mask;
+  }
+  if (Registry.slots[h].extension == NULL) Registry.n++;
+  Registry.slots[h].extension = extension;
+  Registry.slots[h].rules = s;
+}
+
+static struct syntaxRules *lexerIndexGet(char *extension){
+  if (Registry.slots == NULL) return NULL;
+
+  unsigned int h = lexerHash(0, extension, strlen(extension)) & Registry.mask;
+  while (Registry.slots[h].extension){
+    if (!strcmp(Registry.slots[h].extension, extension)) return Registry.slots[h].rules;
+    h = (h + 1) & Registry.mask;
+  }
+  return NULL;
+}
+
+static void lexerRegister(struct syntaxRules *s){
+  for (int i = 0; s->extensions[i]; i++) lexerIndexPut(s->extensions[i], s);
+}
 
-lexer Lexer;
+/* the next word of a definition line, unescaped in place, or NULL at the end of the line */
+static char *lexerNextWord(char **cursor){
+  char *p = *cursor;
+  while (*p == ' ' || *p == '\t') p++;
+  if (*p == '\0') return NULL;
+
+  char *word = p, *out = p;
+  while (*p && *p != ' ' && *p != '\t'){
+    if (p[0] == '\\' && p[1] == 's'){
+      *out++ = ' ';
+      p += 2;
+    } else if (p[0] == '\\' && p[1] == '\\'){
+      *out++ = '\\';
+      p += 2;
+    } else {
+      *out++ = *p++;
+    }
+  }
+  if (*p) p++;
+  *out = '\0';
+  *cursor = p;
+  return word;
+}
+
+static void lexerListAdd(char ***list, int *n, char *word){
+  *list = realloc(*list, sizeof(char *) * (*n + 2));
+  if (*list == NULL) die("realloc");
+  (*list)[(*n)++] = word;
+  (*list)[*n] = NULL;
+}
+
+/* builds rules pointing into text, NULL when it does not name a filetype and an extension */
+static struct syntaxRules *lexerParseSyntax(char *text){
+  struct syntaxRules *s = calloc(1, sizeof(struct syntaxRules));
+  if (s == NULL) die("calloc");
+  int nextensions = 0, nseparators = 0, nkeywords = 0, ndtypes = 0;
+
+  for (char *line = text, *end; line != NULL; line = end){
+    end = strchr(line, '\n');
+    if (end != NULL) *end++ = '\0';
+    char *cr = strchr(line, '\r');
+    if (cr != NULL) *cr = '\0';
+
+    char *key = lexerNextWord(&line), *word;
+    if (key == NULL || key[0] == '#') continue;
+
+    if (!strcmp(key, "filetype")){
+      s->filetype = lexerNextWord(&line);
+    } else if (!strcmp(key, "extensions")){
+      while ((word = lexerNextWord(&line))) lexerListAdd(&s->extensions, &nextensions, word);
+    } else if (!strcmp(key, "separators")){
+      while ((word = lexerNextWord(&line))) lexerListAdd(&s->separators, &nseparators, word);
+    } else if (!strcmp(key, "keywords")){
+      while ((word = lexerNextWord(&line))) lexerListAdd(&s->keywords, &nkeywords, word);
+    } else if (!strcmp(key, "types")){
+      while ((word = lexerNextWord(&line))) lexerListAdd(&s->dtypes, &ndtypes, word);
+    } else if (!strcmp(key, "comment")){
+      s->singleline_comment_start = lexerNextWord(&line);
+    } else if (!strcmp(key, "comment-block")){
+      s->multiline_comment_start = lexerNextWord(&line);
+      s->multiline_comment_end = lexerNextWord(&line);
+      if (s->multiline_comment_end == NULL) s->multiline_comment_start = NULL;
+    } else if (!strcmp(key, "highlight")){
+      while ((word = lexerNextWord(&line))){
+        if (!strcmp(word, "numbers")) s->flags |= HL_HIGHLIGHT_NUMBERS;
+        if (!strcmp(word, "strings")) s->flags |= HL_HIGHLIGHT_STRINGS;
+        if (!strcmp(word, "constants")) s->flags |= HL_HIGHLIGHT_CONSTANTS;
+      }
+    }
+  }
+
+  if (s->filetype == NULL || nextensions == 0){
+    free(s->extensions);
+    free(s->separators);
+    free(s->keywords);
+    free(s->dtypes);
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+static char *lexerReadFile(const char *path){
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return NULL;
+
+  struct stat st;
+  char *text = NULL;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (text = malloc(st.st_size + 1)) != NULL){
+    ssize_t len = 0, n;
+    while (len < st.st_size && (n = read(fd, &text[len], st.st_size - len)) > 0) len += n;
+    text[len] = '\0';
+  }
+  close(fd);
+  return text;
+}
+
+static int lexerIsSyntaxFile(const struct dirent *d){
+  size_t len = strlen(d->d_name);
+  return len > 7 && !strcmp(&d->d_name[len - 7], ".syntax");
+}
+
+/* registers the definitions in dir in name order */
+static void lexerLoadDir(const char *dir){
+  struct dirent **names;
+  int n = scandir(dir, &names, lexerIsSyntaxFile, alphasort);
+  if (n == -1) return;
+
+  for (int i = 0; i < n; i++){
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, names[i]->d_name);
+    free(names[i]);
+
+    char *text = lexerReadFile(path);
+    if (text == NULL) continue;
+    struct syntaxRules *s = lexerParseSyntax(text);
+    if (s != NULL) lexerRegister(s);
+    else free(text);
+  }
+  free(names);
+}
+
+static void lexerLoadRegistry(){
+  char dir[PATH_MAX];
+  char *config = getenv("XDG_CONFIG_HOME"), *home = getenv("HOME");
+
+  Registry.loaded = 1;
+  for (unsigned int j = 0; j < SXDB_ENTRIES; j++) lexerRegister(&SXDB[j]);
+  lexerLoadDir(SYNTAX_DIR);
+
+  if (config != NULL && config[0] != '\0'){
+    snprintf(dir, sizeof(dir), "%s/corvux/syntax", config);
+    lexerLoadDir(dir);
+  } else if (home != NULL){
+    snprintf(dir, sizeof(dir), "%s/.config/corvux/syntax", home);
+    lexerLoadDir(dir);
+  }
+}
+
+
+/*  lexer  */
 
 void lexerClear(){
   Lexer.input = NULL;
@@ -117,6 +518,13 @@ void lexerClear(){
 void initLexer(){
   lexerClear();
   Lexer.syntax = NULL;
+
+  for (int c = 0; c < 256; c++){
+    CHAR_CLASS[c] = 0;
+    if (c >= '0' && c <= '9') CHAR_CLASS[c] |= CH_DIGIT | CH_CONST;
+    if (c >= 'A' && c <= 'Z') CHAR_CLASS[c] |= CH_UPPER | CH_CONST;
+    if (c == '_') CHAR_CLASS[c] |= CH_CONST;
+  }
 }
 
 int lexerSetInput(char *input, int len){
@@ -132,7 +540,7 @@ int lexerSetInput(char *input, int len){
 
 int lexerGetNextToken(int *token_len){
   *token_len = 0;
-  
+
   if (Lexer.pos >= Lexer.len){
     lexerClear();
     return EOF;
@@ -145,55 +553,50 @@ int lexerGetNextToken(int *token_len){
 
   if (Lexer.syntax == NULL){
     *token_len = Lexer.len;
+    Lexer.reach = Lexer.len;
     return PLAIN;
   }
-  
-  char *scs = Lexer.syntax->singleline_comment_start;
-  char *mcs = Lexer.syntax->multiline_comment_start;
-  char *mce = Lexer.syntax->multiline_comment_end;
-  
-  int scs_len = scs ? strlen(scs): 0;
-  int mcs_len = mcs ? strlen(mcs): 0;
-  int mce_len = mce ? strlen(mce): 0;
-
-  int in_string = -1;
-
-  for (int i = Lexer.pos; i < Lexer.len; i++){
-    if (Lexer.input[i] == '\"') in_string *= -1;
-    if (in_string == 1) continue;
-
-    if (!strncmp(&Lexer.input[i], scs, scs_len)){
-      *token_len = scs_len; 
-      Lexer.pos += scs_len;
-      return COMMENT;
-    }
 
-    if (!strncmp(&Lexer.input[i], mcs, mcs_len)){
-      *token_len = mcs_len;
-      Lexer.pos += mcs_len;
-      return MCOM_START;
+  struct syntaxTables *t = Lexer.syntax->tables;
+  char *input = Lexer.input;
+  int len = Lexer.len;
+  int in_string = 0;
+
+  for (int i = Lexer.pos; i < len; i++){
+    if (!t->stop[(unsigned char)input[i]]) continue;
+
+    if (input[i] == '\"'){
+      in_string = !in_string;
+      if (in_string){
+        char *close = memchr(&input[i + 1], '\"', len - i - 1);
+        if (close == NULL) break;
+        i = close - input - 1;
+        continue;
+      }
     }
 
-    if (!strncmp(&Lexer.input[i], mce, mce_len)){
-      *token_len = mce_len;
-      Lexer.pos += mce_len;
-      return MCOM_END;
-    }
+    int kind = t->single[(unsigned char)input[i]];
+    int mlen = 1;
+    if (kind == 0) mlen = lexerMatch(t, &input[i], len - i, &kind);
+    if (mlen == 0) continue;
 
-    for (int j = 0; Lexer.syntax->separators[j]; ++j){
-      int sep_len = strlen(Lexer.syntax->separators[j]);
-      if (!strncmp(&Lexer.input[i], Lexer.syntax->separators[j], sep_len)){
-        *token_len = i - Lexer.pos;
-        int token_type = Lexer.syntax->get_token_type(&Lexer.input[Lexer.pos], *token_len, Lexer.syntax->flags); 
-        Lexer.pos = (i + sep_len) < Lexer.len ? i + sep_len : Lexer.len;
-        return token_type;
-      }
+    Lexer.reach = i + t->longest < len ? i + t->longest : len;
+    if (kind != SEPARATOR){
+      *token_len = mlen;
+      Lexer.pos += mlen;
+      return kind;
     }
+
+    *token_len = i - Lexer.pos;
+    int token_type = lexerTokenType(&input[Lexer.pos], *token_len);
+    Lexer.pos = (i + mlen) < len ? i + mlen : len;
+    return token_type;
   }
 
-  *token_len = Lexer.len - Lexer.pos;
-  int token_type = Lexer.syntax->get_token_type(&Lexer.input[Lexer.pos], *token_len, Lexer.syntax->flags); 
-  Lexer.pos = Lexer.len;
+  Lexer.reach = len;
+  *token_len = len - Lexer.pos;
+  int token_type = lexerTokenType(&input[Lexer.pos], *token_len);
+  Lexer.pos = len;
   return token_type;
 }
 
@@ -201,25 +604,41 @@ int lexerGetPos(){
   return Lexer.pos;
 }
 
+/* how far past where it stopped the scan for a token may read */
+int lexerGetLookahead(){
+  return Lexer.syntax ? Lexer.syntax->tables->longest : 0;
+}
+
+/* the end of the input the scan for the last token read. a marker found
+   past a string ends a token that started before the string, so this
+   can be well beyond where the next token starts */
+int lexerGetReach(){
+  return Lexer.reach;
+}
+
 char *lexerGetSyntaxName(){
   return Lexer.syntax ? Lexer.syntax->filetype : NULL;
 }
 
+/* the syntax in use, for handing over to another thread with lexerUseSyntax */
+void *lexerGetSyntax(){
+  return Lexer.syntax;
+}
+
+void lexerUseSyntax(void *syntax){
+  Lexer.syntax = syntax;
+}
+
 int lexerSetSyntax(char *extension){
   if (extension == NULL){
     return -1;
   }
- 
-  for (unsigned int j = 0; j < SXDB_ENTRIES; j++){
-    struct syntaxRules *s = &SXDB[j];
-    unsigned int i = 0;
-    while (s->extensions[i]){
-      if (!strcmp(s->extensions[i], extension)){
-        Lexer.syntax = s;
-        return 0;
-      }
-      i++;
-    }
-  }
-  return -1;
+
+  if (!Registry.loaded) lexerLoadRegistry();
+  struct syntaxRules *s = lexerIndexGet(extension);
+  if (s == NULL) return -1;
+
+  if (s->tables == NULL) s->tables = lexerCompile(s);
+  Lexer.syntax = s;
+  return 0;
 }
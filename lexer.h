@@ -20,8 +20,12 @@
   int lexerSetInput(char *input, int len);
   int lexerSetSyntax(char *extension);
   char *lexerGetSyntaxName();
+  void *lexerGetSyntax();
+  void lexerUseSyntax(void *syntax);
   int lexerGetNextToken(int* token_len);
   int lexerGetPos();
+  int lexerGetLookahead();
+  int lexerGetReach();
   
 
 
@@ -0,0 +1,219 @@
+#define _DEFAULT_SOURCE
+
+#include "lines.h"
+#include "errors.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LINES_SIMD
+#include <immintrin.h>
+#endif
+
+struct lineIndex {
+  pthread_t thread;
+  int running;
+  const char *map;
+  size_t size;
+  size_t **blocks;        // LINES_BLOCK entries each, allocated as the scan needs them
+  long long nblocks;
+  long long n;            // entries published so far
+  size_t scanned;         // bytes before the last published entry
+  long long total;        // lines in the file, -1 until the scan is over
+  int stop;
+} Lines;
+
+/*  splitting  */
+
+/* the newlines from byte i on, one at a time */
+static int linesSplitFrom(const char *s, size_t i, size_t len, size_t *nl, int n, int max){
+  const char *p;
+  while (n < max && i < len && (p = memchr(s + i, '\n', len - i)) != NULL){
+    nl[n++] = p - s;
+    i = p - s + 1;
+  }
+  return n;
+}
+
+#ifdef LINES_SIMD
+
+/* every x86-64 has SSE2: 16 bytes are compared at once and the matches come out as a bit mask */
+static int linesSplitSse2(const char *s, size_t len, size_t *nl, int max){
+  const __m128i newline = _mm_set1_epi8('\n');
+  size_t i;
+  int n = 0;
+
+  for (i = 0; i + 16 <= len; i += 16){
+    unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i)), newline));
+    while (mask){
+      nl[n++] = i + __builtin_ctz(mask);
+      if (n == max) return n;
+      mask &= mask - 1;
+    }
+  }
+  return linesSplitFrom(s, i, len, nl, n, max);
+}
+
+/* the same 64 bytes at a time, for the processors that have AVX2 */
+__attribute__((target("avx2")))
+static int linesSplitAvx2(const char *s, size_t len, size_t *nl, int max){
+  const __m256i newline = _mm256_set1_epi8('\n');
+  size_t i;
+  int n = 0;
+
+  for (i = 0; i + 64 <= len; i += 64){
+    unsigned int lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i)), newline));
+    unsigned int hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i + 32)), newline));
+    unsigned long long mask = (unsigned long long)hi << 32 | lo;
+    while (mask){
+      nl[n++] = i + __builtin_ctzll(mask);
+      if (n == max) return n;
+      mask &= mask - 1;
+    }
+  }
+  return linesSplitFrom(s, i, len, nl, n, max);
+}
+
+#endif
+
+/* finds the newlines in s[0, len) and stores their offsets in nl, stopping after max.
+   returns how many it found: fewer than max means s has no more */
+int linesSplit(const char *s, size_t len, size_t *nl, int max){
+  if (max <= 0) return 0;
+#ifdef LINES_SIMD
+  if (__builtin_cpu_supports("avx2")) return linesSplitAvx2(s, len, nl, max);
+  return linesSplitSse2(s, len, nl, max);
+#else
+  return linesSplitFrom(s, 0, len, nl, 0, max);
+#endif
+}
+
+/*  index  */
+
+static size_t linesEntry(long long k){
+  return Lines.blocks[k / LINES_BLOCK][k % LINES_BLOCK];
+}
+
+static void *linesIndexScan(void *arg){
+  (void)arg;
+  const char *map = Lines.map, *p = map, *end = map + Lines.size;
+  long long line = 0, n = 0;
+  size_t nl[LINES_STEP];
+
+  while (p < end){
+    if (__atomic_load_n(&Lines.stop, __ATOMIC_RELAXED)) return NULL;
+    if (n % LINES_BLOCK == 0){
+      Lines.blocks[n / LINES_BLOCK] = malloc(sizeof(size_t) * LINES_BLOCK);
+      if (Lines.blocks[n / LINES_BLOCK] == NULL) die("malloc");
+    }
+    Lines.blocks[n / LINES_BLOCK][n % LINES_BLOCK] = p - map;
+    n++;
+    __atomic_store_n(&Lines.scanned, (size_t)(p - map), __ATOMIC_RELAXED);
+    __atomic_store_n(&Lines.n, n, __ATOMIC_RELEASE);
+
+    // the next entry is past the LINES_STEP'th newline from here
+    int k = linesSplit(p, end - p, nl, LINES_STEP);
+    if (k < LINES_STEP){
+      line += k + (p + (k ? nl[k - 1] + 1 : 0) < end);
+      break;
+    }
+    line += LINES_STEP;
+    p += nl[LINES_STEP - 1] + 1;
+  }
+
+  __atomic_store_n(&Lines.scanned, Lines.size, __ATOMIC_RELAXED);
+  __atomic_store_n(&Lines.total, line, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+/* starts indexing a mapping that stays in place until linesIndexStop */
+void linesIndexStart(const char *map, size_t size){
+  linesIndexStop();
+
+  Lines.map = map;
+  Lines.size = size;
+  Lines.nblocks = size / LINES_STEP / LINES_BLOCK + 2;
+  Lines.blocks = calloc(Lines.nblocks, sizeof(size_t *));
+  if (Lines.blocks == NULL) die("calloc");
+  Lines.n = 0;
+  Lines.scanned = 0;
+  Lines.total = -1;
+  Lines.stop = 0;
+
+  // the file is scanned inline when no thread can be had
+  if (pthread_create(&Lines.thread, NULL, linesIndexScan, NULL) == 0) Lines.running = 1;
+  else linesIndexScan(NULL);
+}
+
+void linesIndexStop(){
+  if (Lines.running){
+    __atomic_store_n(&Lines.stop, 1, __ATOMIC_RELAXED);
+    pthread_join(Lines.thread, NULL);
+    Lines.running = 0;
+  }
+
+  for (long long i = 0; Lines.blocks && i < Lines.nblocks; i++) free(Lines.blocks[i]);
+  free(Lines.blocks);
+  Lines.blocks = NULL;
+  Lines.map = NULL;
+  Lines.n = 0;
+  Lines.total = -1;
+}
+
+/* where line starts: returns 1 and sets offset, 0 when the scan has not got there yet and -1 past the last line */
+int linesIndexOffset(long long line, size_t *offset){
+  long long n = __atomic_load_n(&Lines.n, __ATOMIC_ACQUIRE);
+  long long total = __atomic_load_n(&Lines.total, __ATOMIC_ACQUIRE);
+  long long k = line / LINES_STEP;
+
+  if (Lines.map == NULL || line < 0 || (total >= 0 && line >= total)) return -1;
+  if (k >= n) return 0;
+
+  const char *p = Lines.map + linesEntry(k), *end = Lines.map + Lines.size;
+  for (long long i = k * LINES_STEP; i < line; i++){
+    const char *nl = memchr(p, '\n', end - p);
+    if (nl == NULL || nl + 1 == end) return -1;
+    p = nl + 1;
+  }
+  *offset = p - Lines.map;
+  return 1;
+}
+
+/* the line the byte at offset is in: returns 1 and sets line, 0 when the scan has not got there yet */
+int linesIndexLine(size_t offset, long long *line){
+  long long n = __atomic_load_n(&Lines.n, __ATOMIC_ACQUIRE);
+  long long total = __atomic_load_n(&Lines.total, __ATOMIC_ACQUIRE);
+
+  if (Lines.map == NULL || n == 0) return 0;
+  if (offset >= Lines.size) offset = Lines.size - 1;
+  if (total < 0 && offset >= __atomic_load_n(&Lines.scanned, __ATOMIC_RELAXED)) return 0;
+
+  // the last entry at or before offset
+  long long lo = 0, hi = n - 1;
+  while (lo < hi){
+    long long mid = (lo + hi + 1) / 2;
+    if (linesEntry(mid) <= offset) lo = mid;
+    else hi = mid - 1;
+  }
+
+  long long l = lo * LINES_STEP;
+  const char *p = Lines.map + linesEntry(lo), *at = Lines.map + offset;
+  const char *nl;
+  while ((nl = memchr(p, '\n', at - p)) != NULL){
+    p = nl + 1;
+    l++;
+  }
+  *line = l;
+  return 1;
+}
+
+/* lines counted so far, done is set once that is all of them */
+long long linesIndexCount(int *done){
+  long long total = __atomic_load_n(&Lines.total, __ATOMIC_ACQUIRE);
+
+  *done = total >= 0;
+  if (total >= 0) return total;
+  long long n = __atomic_load_n(&Lines.n, __ATOMIC_ACQUIRE);
+  return n > 0 ? (n - 1) * LINES_STEP : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef LINES_H
+#define LINES_H
+
+  #include <stddef.h>
+
+  /*
+    A sparse index of the lines of a mapped file. A thread scans the file
+    once and records where every LINES_STEP'th line starts, the main thread
+    looks up what it has passed while it goes on. A line is then found from
+    the entry below it with a scan over fewer than LINES_STEP lines.
+
+    Lines end at a newline, text after the last one is a line of its own.
+
+    linesSplit finds the newlines of a block with SSE2 or AVX2 compares
+    where the processor has them and memchr elsewhere, for the index and
+    for loading rows alike.
+  */
+
+  #define LINES_STEP 1024
+  #define LINES_BLOCK 65536   // entries allocated at once
+
+  int linesSplit(const char *s, size_t len, size_t *nl, int max);
+
+  void linesIndexStart(const char *map, size_t size);
+  void linesIndexStop();
+  int linesIndexOffset(long long line, size_t *offset);
+  int linesIndexLine(size_t offset, long long *line);
+  long long linesIndexCount(int *done);
+
+#endif // !LINES_H
@@ -0,0 +1,807 @@
+#include "regex.h"
+#include "errors.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RE_MAX_NODES 4096
+#define RE_MAX_NFA 16384
+#define RE_MAX_REPEAT 1000
+#define DFA_MAX_STATES 1024  // a scan that needs more starts the cache over
+#define DFA_HASH 2048
+
+/*  syntax tree  */
+
+enum reNodeType {
+  RE_SET = 1,  // one byte from a set
+  RE_CAT,
+  RE_ALT,
+  RE_REPEAT,   // a repeated min to max times, max -1 for no limit
+  RE_BOL,
+  RE_EOL,
+  RE_EMPTY
+};
+
+struct reNode {
+  unsigned char type;
+  int a, b;
+  int set;
+  int min, max;
+};
+
+/*  nfa  */
+
+enum nfaOp {
+  NFA_SET = 1,  // consumes a byte in set, goes to out
+  NFA_SPLIT,    // goes to out and out1
+  NFA_BOL,      // goes to out at the start of a line
+  NFA_EOL,      // goes to out at the end of a line
+  NFA_MATCH
+};
+
+struct nfaState {
+  unsigned char op;
+  int out, out1;
+  int set;
+};
+
+struct nfa {
+  struct nfaState *states;
+  int n, cap;
+  int start;
+};
+
+/*  dfa  */
+
+struct dfaState {
+  int *list;       // the NFA_SET states the dfa state stands for, sorted
+  int n;
+  unsigned char match, match_eol;  // a match ends here, or ends here at the end of a line
+  unsigned int hash;
+  int chain;
+};
+
+struct dfa {
+  struct regex *re;
+  struct nfa *nfa;
+  int unanchored;  // every position also starts a new match
+  struct dfaState *states;
+  int n, cap;
+  int *next;       // the move from state i on byte class k at (i << shift) + k, as i << shift, -1 until built
+  int head[DFA_HASH];
+  int start_bol, start_mid;
+};
+
+struct regex {
+  struct reNode *nodes;
+  int nnodes, nodes_cap;
+  unsigned char (*sets)[32];
+  int nsets, sets_cap;
+  int root;
+
+  unsigned char cls[256];  // byte to class, bytes in one class are in the same sets
+  unsigned char rep[256];  // a byte of each class
+  int ncls, shift;         // 1 << shift is at least ncls
+
+  struct nfa fwd, rev;
+  struct dfa search, back, longest;
+
+  // closure scratch, sized to the larger nfa
+  int *mark, *stack, *list, *eols;
+  int gen;
+};
+
+/*  parsing  */
+
+struct reParser {
+  struct regex *re;
+  const char *s;
+  int len, pos;
+  int error;
+};
+
+static int reNode(struct reParser *ps, int type, int a, int b){
+  struct regex *re = ps->re;
+  if (re->nnodes == RE_MAX_NODES){
+    ps->error = 1;
+    return 0;
+  }
+  if (re->nnodes == re->nodes_cap){
+    re->nodes_cap = re->nodes_cap ? re->nodes_cap * 2 : 64;
+    re->nodes = realloc(re->nodes, sizeof(struct reNode) * re->nodes_cap);
+    if (re->nodes == NULL) die("realloc");
+  }
+  struct reNode *n = &re->nodes[re->nnodes];
+  n->type = type;
+  n->a = a;
+  n->b = b;
+  n->set = n->min = n->max = 0;
+  return re->nnodes++;
+}
+
+static int reNewSet(struct regex *re){
+  if (re->nsets == re->sets_cap){
+    re->sets_cap = re->sets_cap ? re->sets_cap * 2 : 16;
+    re->sets = realloc(re->sets, 32 * re->sets_cap);
+    if (re->sets == NULL) die("realloc");
+  }
+  memset(re->sets[re->nsets], 0, 32);
+  return re->nsets++;
+}
+
+static void reSetAdd(unsigned char *set, int lo, int hi){
+  for (int c = lo; c <= hi; c++) set[c >> 3] |= 1 << (c & 7);
+}
+
+static int reSetHas(const unsigned char *set, int c){
+  return set[c >> 3] & (1 << (c & 7));
+}
+
+/* adds the class of a \d \w \s escape, returns 0 when c is not one */
+static int reClassEscape(unsigned char *set, int c){
+  unsigned char tmp[32] = {0};
+  switch (c | 0x20){
+    case 'd':
+      reSetAdd(tmp, '0', '9');
+      break;
+    case 'w':
+      reSetAdd(tmp, '0', '9');
+      reSetAdd(tmp, 'a', 'z');
+      reSetAdd(tmp, 'A', 'Z');
+      reSetAdd(tmp, '_', '_');
+      break;
+    case 's':
+      reSetAdd(tmp, '\t', '\r');
+      reSetAdd(tmp, ' ', ' ');
+      break;
+    default:
+      return 0;
+  }
+  int negate = c >= 'A' && c <= 'Z';
+  for (int i = 0; i < 32; i++) set[i] |= negate ? ~tmp[i] : tmp[i];
+  return 1;
+}
+
+static int reEscapeChar(int c){
+  switch (c){
+    case 't': return '\t';
+    case 'n': return '\n';
+    case 'r': return '\r';
+    case 'f': return '\f';
+    case 'v': return '\v';
+    case 'e': return 27;
+    default: return c;
+  }
+}
+
+/* a newline ends the line, nothing matches it */
+static int reSetNode(struct reParser *ps, int set){
+  ps->re->sets[set]['\n' >> 3] &= ~(1 << ('\n' & 7));
+  int n = reNode(ps, RE_SET, 0, 0);
+  if (!ps->error) ps->re->nodes[n].set = set;
+  return n;
+}
+
+static int reParseClass(struct reParser *ps){
+  int set = reNewSet(ps->re);
+  unsigned char *s = ps->re->sets[set];
+  int negate = 0, first = 1;
+
+  if (ps->pos < ps->len && ps->s[ps->pos] == '^'){
+    negate = 1;
+    ps->pos++;
+  }
+  while (1){
+    if (ps->pos >= ps->len){
+      ps->error = 1;
+      return 0;
+    }
+    int c = (unsigned char)ps->s[ps->pos++];
+    if (c == ']' && !first) break;
+    first = 0;
+
+    if (c == '\\' && ps->pos < ps->len){
+      c = (unsigned char)ps->s[ps->pos++];
+      s = ps->re->sets[set];
+      if (reClassEscape(s, c)) continue;
+      c = reEscapeChar(c);
+    }
+    int hi = c;
+    if (ps->pos + 1 < ps->len && ps->s[ps->pos] == '-' && ps->s[ps->pos + 1] != ']'){
+      ps->pos++;
+      hi = (unsigned char)ps->s[ps->pos++];
+      if (hi == '\\' && ps->pos < ps->len) hi = reEscapeChar((unsigned char)ps->s[ps->pos++]);
+      if (hi < c){
+        ps->error = 1;
+        return 0;
+      }
+    }
+    reSetAdd(s, c, hi);
+  }
+
+  if (negate){
+    for (int i = 0; i < 32; i++) s[i] = ~s[i];
+  }
+  return reSetNode(ps, set);
+}
+
+static int reParseAlt(struct reParser *ps);
+
+static int reParseAtom(struct reParser *ps){
+  int c = (unsigned char)ps->s[ps->pos++];
+  int set;
+
+  switch (c){
+    case '(':
+      if (ps->pos + 1 < ps->len && ps->s[ps->pos] == '?' && ps->s[ps->pos + 1] == ':') ps->pos += 2;
+      int n = reParseAlt(ps);
+      if (ps->pos >= ps->len || ps->s[ps->pos] != ')'){
+        ps->error = 1;
+        return 0;
+      }
+      ps->pos++;
+      return n;
+    case '[':
+      return reParseClass(ps);
+    case '.':
+      set = reNewSet(ps->re);
+      reSetAdd(ps->re->sets[set], 0, 255);
+      return reSetNode(ps, set);
+    case '^':
+      return reNode(ps, RE_BOL, 0, 0);
+    case '$':
+      return reNode(ps, RE_EOL, 0, 0);
+    case '*': case '+': case '?': case ')':
+      ps->error = 1;
+      return 0;
+    case '\\':
+      if (ps->pos == ps->len){
+        ps->error = 1;
+        return 0;
+      }
+      c = (unsigned char)ps->s[ps->pos++];
+      set = reNewSet(ps->re);
+      if (!reClassEscape(ps->re->sets[set], c)){
+        c = reEscapeChar(c);
+        reSetAdd(ps->re->sets[set], c, c);
+      }
+      return reSetNode(ps, set);
+    default:
+      set = reNewSet(ps->re);
+      reSetAdd(ps->re->sets[set], c, c);
+      return reSetNode(ps, set);
+  }
+}
+
+static int reParseNumber(struct reParser *ps, int *n){
+  int start = ps->pos;
+  *n = 0;
+  while (ps->pos < ps->len && ps->s[ps->pos] >= '0' && ps->s[ps->pos] <= '9'){
+    *n = *n * 10 + ps->s[ps->pos++] - '0';
+    if (*n > RE_MAX_REPEAT) *n = RE_MAX_REPEAT + 1;
+  }
+  return ps->pos > start;
+}
+
+/* parses {n}, {n,} or {n,m} after the '{', rewinds and returns 0 when it is a literal brace */
+static int reParseBraces(struct reParser *ps, int *min, int *max){
+  int start = ps->pos;
+  if (!reParseNumber(ps, min)) goto literal;
+  *max = *min;
+  if (ps->pos < ps->len && ps->s[ps->pos] == ','){
+    ps->pos++;
+    if (!reParseNumber(ps, max)) *max = -1;
+  }
+  if (ps->pos >= ps->len || ps->s[ps->pos] != '}') goto literal;
+  ps->pos++;
+  if (*min > RE_MAX_REPEAT || *max > RE_MAX_REPEAT || (*max >= 0 && *max < *min)) ps->error = 1;
+  return 1;
+
+literal:
+  ps->pos = start;
+  return 0;
+}
+
+static int reParseRepeat(struct reParser *ps){
+  int n;
+  if (ps->s[ps->pos] == '{'){
+    // a brace that does not start a count is a literal
+    int set = reNewSet(ps->re);
+    reSetAdd(ps->re->sets[set], '{', '{');
+    ps->pos++;
+    n = reSetNode(ps, set);
+  } else {
+    n = reParseAtom(ps);
+  }
+
+  while (!ps->error && ps->pos < ps->len){
+    int c = ps->s[ps->pos], min, max;
+    if (c == '*'){
+      min = 0;
+      max = -1;
+    } else if (c == '+'){
+      min = 1;
+      max = -1;
+    } else if (c == '?'){
+      min = 0;
+      max = 1;
+    } else if (c == '{'){
+      ps->pos++;
+      if (!reParseBraces(ps, &min, &max)){
+        ps->pos--;
+        break;
+      }
+      ps->pos--;
+    } else {
+      break;
+    }
+    ps->pos++;
+    // a lazy quantifier matches the same text for a longest match
+    if (ps->pos < ps->len && ps->s[ps->pos] == '?' && c != '?') ps->pos++;
+
+    int r = reNode(ps, RE_REPEAT, n, 0);
+    if (ps->error) break;
+    ps->re->nodes[r].min = min;
+    ps->re->nodes[r].max = max;
+    n = r;
+  }
+  return n;
+}
+
+static int reParseCat(struct reParser *ps){
+  int n = -1;
+  while (!ps->error && ps->pos < ps->len && ps->s[ps->pos] != '|' && ps->s[ps->pos] != ')'){
+    int r = reParseRepeat(ps);
+    n = n < 0 ? r : reNode(ps, RE_CAT, n, r);
+  }
+  return n < 0 ? reNode(ps, RE_EMPTY, 0, 0) : n;
+}
+
+static int reParseAlt(struct reParser *ps){
+  int n = reParseCat(ps);
+  while (!ps->error && ps->pos < ps->len && ps->s[ps->pos] == '|'){
+    ps->pos++;
+    n = reNode(ps, RE_ALT, n, reParseCat(ps));
+  }
+  return n;
+}
+
+/*  nfa construction  */
+
+static int nfaState(struct nfa *nfa, int op, int out, int out1, int *error){
+  if (nfa->n == RE_MAX_NFA){
+    *error = 1;
+    return 0;
+  }
+  if (nfa->n == nfa->cap){
+    nfa->cap = nfa->cap ? nfa->cap * 2 : 256;
+    nfa->states = realloc(nfa->states, sizeof(struct nfaState) * nfa->cap);
+    if (nfa->states == NULL) die("realloc");
+  }
+  struct nfaState *st = &nfa->states[nfa->n];
+  st->op = op;
+  st->out = out;
+  st->out1 = out1;
+  st->set = 0;
+  return nfa->n++;
+}
+
+/* builds node in front of next and returns its entry, reversed builds it for scanning backwards */
+static int nfaBuild(struct regex *re, struct nfa *nfa, int node, int next, int reversed, int *error){
+  struct reNode *n = &re->nodes[node];
+  int s, x;
+  if (*error) return 0;
+
+  switch (n->type){
+    case RE_SET:
+      s = nfaState(nfa, NFA_SET, next, 0, error);
+      if (!*error) nfa->states[s].set = n->set;
+      return s;
+    case RE_CAT:
+      if (reversed) return nfaBuild(re, nfa, n->b, nfaBuild(re, nfa, n->a, next, reversed, error), reversed, error);
+      return nfaBuild(re, nfa, n->a, nfaBuild(re, nfa, n->b, next, reversed, error), reversed, error);
+    case RE_ALT:
+      x = nfaBuild(re, nfa, n->a, next, reversed, error);
+      return nfaState(nfa, NFA_SPLIT, x, nfaBuild(re, nfa, n->b, next, reversed, error), error);
+    case RE_BOL:
+      return nfaState(nfa, reversed ? NFA_EOL : NFA_BOL, next, 0, error);
+    case RE_EOL:
+      return nfaState(nfa, reversed ? NFA_BOL : NFA_EOL, next, 0, error);
+    case RE_EMPTY:
+      return next;
+    case RE_REPEAT:
+      x = next;
+      if (n->max < 0){
+        // the loop: a split that either runs the body again or leaves
+        s = nfaState(nfa, NFA_SPLIT, 0, next, error);
+        int body = nfaBuild(re, nfa, n->a, s, reversed, error);
+        if (*error) return 0;
+        nfa->states[s].out = body;
+        x = s;
+      } else {
+        // optional copies nest, a{0,2} is (a(a)?)?
+        for (int i = n->min; i < n->max && !*error; i++)
+          x = nfaState(nfa, NFA_SPLIT, nfaBuild(re, nfa, n->a, x, reversed, error), next, error);
+      }
+      for (int i = 0; i < n->min && !*error; i++) x = nfaBuild(re, nfa, n->a, x, reversed, error);
+      return x;
+  }
+  return next;
+}
+
+/*  dfa  */
+
+static int reCompareInt(const void *a, const void *b){
+  return *(const int *)a - *(const int *)b;
+}
+
+/* follows every edge that consumes nothing from the seeds. Collects the
+   NFA_SET states into re->list and the NFA_EOL states into re->eols. */
+static void dfaClosure(struct regex *re, struct nfa *nfa, int *seeds, int nseeds,
+                       int bol, int eol, int *n, int *neols, int *match){
+  int sp = 0;
+  re->gen++;
+  *n = *neols = *match = 0;
+
+  for (int i = 0; i < nseeds; i++) re->stack[sp++] = seeds[i];
+  while (sp){
+    int id = re->stack[--sp];
+    if (re->mark[id] == re->gen) continue;
+    re->mark[id] = re->gen;
+
+    struct nfaState *st = &nfa->states[id];
+    switch (st->op){
+      case NFA_SET:
+        re->list[(*n)++] = id;
+        break;
+      case NFA_MATCH:
+        *match = 1;
+        break;
+      case NFA_SPLIT:
+        re->stack[sp++] = st->out1;
+        re->stack[sp++] = st->out;
+        break;
+      case NFA_BOL:
+        if (bol) re->stack[sp++] = st->out;
+        break;
+      case NFA_EOL:
+        if (eol) re->stack[sp++] = st->out;
+        else re->eols[(*neols)++] = st->out;
+        break;
+    }
+  }
+}
+
+static void dfaFreeStates(struct dfa *d){
+  for (int i = 0; i < d->n; i++) free(d->states[i].list);
+  d->n = 0;
+  for (int i = 0; i < DFA_HASH; i++) d->head[i] = -1;
+}
+
+/* finds or adds the dfa state for the closure of seeds */
+static int dfaAdd(struct dfa *d, int *seeds, int nseeds, int bol){
+  struct regex *re = d->re;
+  int n, neols, match, match_eol;
+
+  // where a line ends, the $ states that were left behind may still reach a match
+  dfaClosure(re, d->nfa, seeds, nseeds, bol, 0, &n, &neols, &match);
+  match_eol = match;
+  if (neols && !match){
+    int *eols = malloc(sizeof(int) * neols);
+    if (eols == NULL) die("malloc");
+    memcpy(eols, re->eols, sizeof(int) * neols);
+    int *list = malloc(sizeof(int) * (n + 1));
+    if (list == NULL) die("malloc");
+    memcpy(list, re->list, sizeof(int) * n);
+
+    int n2, neols2;
+    dfaClosure(re, d->nfa, eols, neols, 0, 1, &n2, &neols2, &match_eol);
+    memcpy(re->list, list, sizeof(int) * n);
+    free(list);
+    free(eols);
+  }
+  qsort(re->list, n, sizeof(int), reCompareInt);
+
+  unsigned int h = 2166136261u ^ (match | match_eol << 1);
+  for (int i = 0; i < n; i++) h = (h ^ re->list[i]) * 16777619u;
+
+  for (int i = d->head[h % DFA_HASH]; i >= 0; i = d->states[i].chain){
+    struct dfaState *ds = &d->states[i];
+    if (ds->hash == h && ds->n == n && ds->match == match && ds->match_eol == match_eol &&
+        !memcmp(ds->list, re->list, sizeof(int) * n)) return i;
+  }
+
+  if (d->n == d->cap){
+    d->cap = d->cap ? d->cap * 2 : 64;
+    d->states = realloc(d->states, sizeof(struct dfaState) * d->cap);
+    d->next = realloc(d->next, sizeof(int) * (d->cap << re->shift));
+    if (d->states == NULL || d->next == NULL) die("realloc");
+  }
+  struct dfaState *ds = &d->states[d->n];
+  ds->list = malloc(sizeof(int) * (n + 1));
+  if (ds->list == NULL) die("malloc");
+  memcpy(ds->list, re->list, sizeof(int) * n);
+  memset(&d->next[d->n << re->shift], 0xff, sizeof(int) << re->shift);
+  ds->n = n;
+  ds->match = match;
+  ds->match_eol = match_eol;
+  ds->hash = h;
+  ds->chain = d->head[h % DFA_HASH];
+  d->head[h % DFA_HASH] = d->n;
+  return d->n++;
+}
+
+static void dfaStart(struct dfa *d){
+  d->start_bol = dfaAdd(d, &d->nfa->start, 1, 1);
+  d->start_mid = dfaAdd(d, &d->nfa->start, 1, 0);
+}
+
+static void dfaInit(struct dfa *d, struct regex *re, struct nfa *nfa, int unanchored){
+  d->re = re;
+  d->nfa = nfa;
+  d->unanchored = unanchored;
+  d->states = NULL;
+  d->next = NULL;
+  d->n = d->cap = 0;
+  for (int i = 0; i < DFA_HASH; i++) d->head[i] = -1;
+  dfaStart(d);
+}
+
+/* builds the move from state st on byte class k */
+static int dfaBuild(struct dfa *d, int st, int k){
+  struct regex *re = d->re;
+  struct dfaState *ds = &d->states[st];
+  int c = re->rep[k], nseeds = 0;
+  int *seeds = malloc(sizeof(int) * (ds->n + 1));
+  if (seeds == NULL) die("malloc");
+
+  for (int i = 0; i < ds->n; i++){
+    struct nfaState *ns = &d->nfa->states[ds->list[i]];
+    if (reSetHas(re->sets[ns->set], c)) seeds[nseeds++] = ns->out;
+  }
+  if (d->unanchored) seeds[nseeds++] = d->nfa->start;
+
+  if (d->n >= DFA_MAX_STATES){
+    // the cache is full: start over with the states this scan needs next
+    dfaFreeStates(d);
+    dfaStart(d);
+    int next = dfaAdd(d, seeds, nseeds, 0);
+    free(seeds);
+    return next;
+  }
+
+  // line breaks depend on what follows them and are never cached, nor
+  // are moves into a match for the first scan, which stops there. So the
+  // scan only needs one test per byte, for a move still to be built.
+  int next = dfaAdd(d, seeds, nseeds, 0);
+  if (c != '\n' && c != '\r' && !(d == &re->search && d->states[next].match))
+    d->next[(st << re->shift) + k] = next << re->shift;
+  free(seeds);
+  return next;
+}
+
+static inline int dfaStep(struct dfa *d, int st, unsigned char c){
+  int k = d->re->cls[c];
+  int next = d->next[(st << d->re->shift) + k];
+  return next >= 0 ? next >> d->re->shift : dfaBuild(d, st, k);
+}
+
+/*  compile  */
+
+/* splits the bytes into classes no set tells apart */
+static void reClasses(struct regex *re){
+  int map[512];
+  memset(re->cls, 0, sizeof(re->cls));
+  re->ncls = 1;
+
+  // line breaks get their own classes so scans can tell them apart
+  int nl = reNewSet(re), cr = reNewSet(re);
+  reSetAdd(re->sets[nl], '\n', '\n');
+  reSetAdd(re->sets[cr], '\r', '\r');
+
+  for (int s = 0; s < re->nsets && re->ncls < 256; s++){
+    int n = 0;
+    for (int i = 0; i < re->ncls * 2; i++) map[i] = -1;
+    for (int c = 0; c < 256; c++){
+      int key = re->cls[c] * 2 + (reSetHas(re->sets[s], c) ? 1 : 0);
+      if (map[key] < 0) map[key] = n++;
+      re->cls[c] = map[key];
+    }
+    re->ncls = n;
+  }
+  for (int c = 255; c >= 0; c--) re->rep[re->cls[c]] = c;
+  while ((1 << re->shift) < re->ncls) re->shift++;
+}
+
+struct regex *regexCompile(const char *s, int len){
+  struct regex *re = calloc(1, sizeof(struct regex));
+  if (re == NULL) die("calloc");
+
+  struct reParser ps = {re, s, len, 0, 0};
+  re->root = reParseAlt(&ps);
+  if (!ps.error && ps.pos != len) ps.error = 1;  // a ) with no (
+
+  int error = ps.error;
+  if (!error){
+    reClasses(re);
+    re->fwd.start = nfaBuild(re, &re->fwd, re->root, nfaState(&re->fwd, NFA_MATCH, 0, 0, &error), 0, &error);
+    re->rev.start = nfaBuild(re, &re->rev, re->root, nfaState(&re->rev, NFA_MATCH, 0, 0, &error), 1, &error);
+  }
+  if (error){
+    regexFree(re);
+    return NULL;
+  }
+
+  int n = re->fwd.n > re->rev.n ? re->fwd.n : re->rev.n;
+  re->mark = calloc(n, sizeof(int));
+  re->stack = malloc(sizeof(int) * (n * 3 + 1));
+  re->list = malloc(sizeof(int) * n);
+  re->eols = malloc(sizeof(int) * n);
+  if (re->mark == NULL || re->stack == NULL || re->list == NULL || re->eols == NULL) die("malloc");
+
+  dfaInit(&re->search, re, &re->fwd, 1);
+  dfaInit(&re->back, re, &re->rev, 1);
+  dfaInit(&re->longest, re, &re->fwd, 0);
+  return re;
+}
+
+void regexFree(struct regex *re){
+  if (re == NULL) return;
+  struct dfa *dfas[] = {&re->search, &re->back, &re->longest};
+  for (int i = 0; i < 3; i++){
+    if (dfas[i]->re == NULL) continue;
+    dfaFreeStates(dfas[i]);
+    free(dfas[i]->states);
+    free(dfas[i]->next);
+  }
+  free(re->fwd.states);
+  free(re->rev.states);
+  free(re->nodes);
+  free(re->sets);
+  free(re->mark);
+  free(re->stack);
+  free(re->list);
+  free(re->eols);
+  free(re);
+}
+
+/*  matching  */
+
+/* a line ends at p: the end, a newline, or carriage returns before one */
+static int reAtEol(char *p, char *end){
+  while (p < end && *p == '\r') p++;
+  return p == end || *p == '\n';
+}
+
+/* runs d from state st at p to the end of the line, or until no thread is left,
+   and returns where the last match on the way ended, NULL for none */
+static char *reLastEnd(struct dfa *d, int st, char *p, char *end){
+  char *last = NULL;
+  for (;; p++){
+    struct dfaState *ds = &d->states[st];
+    int eol = p == end || ((*p == '\n' || *p == '\r') && reAtEol(p, end));
+    if (ds->match || (eol && ds->match_eol)) last = p;
+    if (eol || ds->n == 0) return last;
+    st = dfaStep(d, st, *p);
+  }
+}
+
+/* the length of the longest match from start, which is at the start of a line when bol is set */
+static int reLongest(struct regex *re, char *start, int bol, char *end){
+  struct dfa *d = &re->longest;
+  char *last = reLastEnd(d, bol ? d->start_bol : d->start_mid, start, end);
+  return last ? last - start : 0;
+}
+
+/*
+  Four scans find the leftmost-longest match, each over no more than the
+  text from `from` to the furthest end of a match starting before the one
+  found. The first runs forward from `from`, starting a match at every
+  byte, and stops where the earliest match ends, at e. The second carries
+  on from there with only the matches already started, none started after
+  e can be leftmost, up to where the last of them could end. The third
+  scans back from there with the reversed pattern, and the last position
+  it matches at is the leftmost start. The last runs forward from there
+  for the longest end. s is where the line from is on starts.
+*/
+char *regexFind(struct regex *re, char *s, char *from, char *end, int *match_len){
+  struct dfa *d = &re->search;
+  char *p = from;
+  int st = (from == s || from[-1] == '\n') ? d->start_bol : d->start_mid;
+  int off = st << re->shift;
+
+  // the hot loop: one table load per byte, states are kept as offsets into it
+  while (!d->states[st].match){
+    if (p == end){
+      if (d->states[off >> re->shift].match_eol) break;
+      return NULL;
+    }
+    unsigned char c = *p;
+    int next = d->next[off + re->cls[c]];
+    if (next < 0){
+      st = off >> re->shift;
+      if ((c == '\n' || c == '\r') && reAtEol(p, end)){
+        if (d->states[st].match_eol) break;
+        while (p < end && *p != '\n') p++;
+        if (p == end) return NULL;
+        st = d->start_bol;
+      } else {
+        st = dfaBuild(d, st, re->cls[c]);
+      }
+      next = st << re->shift;
+    }
+    off = next;
+    p++;
+  }
+  char *e = p;
+
+  // the line the match is on, as far as from
+  char *line = e;
+  while (line > from && line[-1] != '\n') line--;
+  int bol = line == s || line[-1] == '\n';
+
+  struct dfaState *at = &d->states[off >> re->shift];
+  d = &re->longest;
+  char *far = reLastEnd(d, dfaAdd(d, at->list, at->n, 0), e, end);
+  if (far == NULL) far = e;
+
+  d = &re->back;
+  st = reAtEol(far, end) ? d->start_bol : d->start_mid;
+  char *start = e;
+  for (p = far;; p--){
+    struct dfaState *ds = &d->states[st];
+    if (ds->match || (p == line && bol && ds->match_eol)) start = p;
+    if (p == line) break;
+    st = dfaStep(d, st, p[-1]);
+  }
+
+  *match_len = reLongest(re, start, start == line && bol, end);
+  return start;
+}
+
+/* a match starts at p, where its line has already ended: only an empty one can */
+static int reEmptyAt(struct regex *re, char *s, char *p){
+  struct dfa *d = &re->search;
+  struct dfaState *ds = &d->states[p == s || p[-1] == '\n' ? d->start_bol : d->start_mid];
+  return ds->match || ds->match_eol;
+}
+
+/*
+  The last match that starts in [s, until), or at end too when until is
+  end. One scan back with the reversed pattern from the end of the line
+  until is on: the first position it matches at is the last start, then
+  the longest match from there is taken.
+*/
+char *regexFindLast(struct regex *re, char *s, char *until, char *end, int *match_len){
+  char *top = until == end ? end : until - 1;  // the last position a match may start at
+  if (top < s) return NULL;
+
+  char *nl = top;
+  while (nl < end && *nl != '\n') nl++;
+  while (1){
+    char *line = nl, *le = nl, *p;
+    while (line > s && line[-1] != '\n') line--;
+    while (le > line && le[-1] == '\r') le--;
+
+    for (p = nl < top ? nl : top; p > le; p--){
+      if (reEmptyAt(re, s, p)){
+        *match_len = 0;
+        return p;
+      }
+    }
+
+    struct dfa *d = &re->back;
+    int st = d->start_bol;
+    for (p = le;; p--){
+      struct dfaState *ds = &d->states[st];
+      if (p <= top && (ds->match || (p == line && ds->match_eol))){
+        *match_len = reLongest(re, p, p == line, end);
+        return p;
+      }
+      if (p == line) break;
+      st = dfaStep(d, st, p[-1]);
+    }
+
+    if (line == s) return NULL;
+    nl = line - 1;
+  }
+}
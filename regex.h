@@ -0,0 +1,20 @@
+#ifndef REGEX_H
+#define REGEX_H
+
+  /*
+    Regular expressions without backtracking: the pattern becomes an NFA,
+    searched through DFAs whose states are built the first time a scan
+    reaches them. A match is leftmost-longest and lies within one line.
+
+    Syntax: literals, ., [] classes with ranges and ^, \d \w \s \D \W \S,
+    ^ $, ( ), |, * + ? and {n} {n,} {n,m}.
+  */
+
+  struct regex;
+
+  struct regex *regexCompile(const char *s, int len);
+  void regexFree(struct regex *re);
+  char *regexFind(struct regex *re, char *s, char *from, char *end, int *match_len);
+  char *regexFindLast(struct regex *re, char *s, char *until, char *end, int *match_len);
+
+#endif // !REGEX_H
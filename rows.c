@@ -0,0 +1,311 @@
+#include "rows.h"
+#include "errors.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ROWS_LEAF_MAX 64
+#define ROWS_NODE_MAX 32
+
+struct rowNode {
+  int is_leaf;
+  int n;
+  int count;
+  struct rowNode *parent;
+};
+
+struct rowLeaf {
+  struct rowNode hdr;
+  struct rowLeaf *prev, *next;
+  erow rows[ROWS_LEAF_MAX];
+};
+
+struct rowInner {
+  struct rowNode hdr;
+  struct rowNode *child[ROWS_NODE_MAX];
+};
+
+static struct rowLeaf *rowsNewLeaf(){
+  struct rowLeaf *l = calloc(1, sizeof(struct rowLeaf));
+  if (l == NULL) die("calloc");
+  l->hdr.is_leaf = 1;
+  return l;
+}
+
+static struct rowInner *rowsNewInner(){
+  struct rowInner *in = calloc(1, sizeof(struct rowInner));
+  if (in == NULL) die("calloc");
+  return in;
+}
+
+/* walks down to the leaf holding row *at and leaves the offset inside it in *at.
+   with insert set, an offset equal to a child's count stays in that child
+   so appends land at the end of the last leaf */
+static struct rowLeaf *rowsFind(struct rowTree *t, int *at, int insert){
+  struct rowNode *n = t->root;
+  while (!n->is_leaf){
+    struct rowInner *in = (struct rowInner *)n;
+    int i;
+    for (i = 0; i < n->n - 1; i++){
+      int c = in->child[i]->count;
+      if (*at < c || (insert && *at == c)) break;
+      *at -= c;
+    }
+    n = in->child[i];
+  }
+  return (struct rowLeaf *)n;
+}
+
+static void rowsAddCount(struct rowNode *n, int delta){
+  for (; n != NULL; n = n->parent) n->count += delta;
+}
+
+static int rowsChildIndex(struct rowInner *p, struct rowNode *c){
+  for (int i = 0; i < p->hdr.n; i++){
+    if (p->child[i] == c) return i;
+  }
+  return -1;
+}
+
+static void rowsRecount(struct rowInner *in){
+  in->hdr.count = 0;
+  for (int i = 0; i < in->hdr.n; i++) in->hdr.count += in->child[i]->count;
+}
+
+/* links a freshly split off node in right after its left half, splitting full parents on the way up */
+static void rowsInsertNode(struct rowTree *t, struct rowNode *left, struct rowNode *right){
+  struct rowInner *p = (struct rowInner *)left->parent;
+
+  if (p == NULL){
+    p = rowsNewInner();
+    p->child[0] = left;
+    p->child[1] = right;
+    p->hdr.n = 2;
+    p->hdr.count = left->count + right->count;
+    left->parent = right->parent = &p->hdr;
+    t->root = &p->hdr;
+    return;
+  }
+
+  struct rowNode *tmp[ROWS_NODE_MAX + 1];
+  int i = rowsChildIndex(p, left) + 1;
+  int n = p->hdr.n;
+
+  memcpy(tmp, p->child, sizeof(struct rowNode *) * i);
+  tmp[i] = right;
+  memcpy(&tmp[i + 1], &p->child[i], sizeof(struct rowNode *) * (n - i));
+  n++;
+  right->parent = &p->hdr;
+
+  if (n <= ROWS_NODE_MAX){
+    memcpy(p->child, tmp, sizeof(struct rowNode *) * n);
+    p->hdr.n = n;
+    return;
+  }
+
+  struct rowInner *q = rowsNewInner();
+  int split = (i == n - 1) ? n - 1 : n / 2;
+
+  p->hdr.n = split;
+  memcpy(p->child, tmp, sizeof(struct rowNode *) * split);
+  q->hdr.n = n - split;
+  memcpy(q->child, &tmp[split], sizeof(struct rowNode *) * q->hdr.n);
+  for (int j = 0; j < q->hdr.n; j++) q->child[j]->parent = &q->hdr;
+
+  rowsRecount(p);
+  rowsRecount(q);
+  rowsInsertNode(t, &p->hdr, &q->hdr);
+}
+
+static void rowsFreeNode(struct rowNode *n){
+  if (!n->is_leaf){
+    struct rowInner *in = (struct rowInner *)n;
+    for (int i = 0; i < n->n; i++) rowsFreeNode(in->child[i]);
+  }
+  free(n);
+}
+
+static void rowsUnlinkLeaf(struct rowLeaf *l){
+  if (l->prev) l->prev->next = l->next;
+  if (l->next) l->next->prev = l->prev;
+}
+
+/* merges an underfull node with a sibling under the same parent and drops empty nodes */
+static void rowsRebalance(struct rowTree *t, struct rowNode *n){
+  struct rowInner *p = (struct rowInner *)n->parent;
+
+  if (p == NULL){
+    if (!n->is_leaf && n->n == 0){
+      free(n);
+      t->root = NULL;
+    } else if (!n->is_leaf && n->n == 1){
+      t->root = ((struct rowInner *)n)->child[0];
+      t->root->parent = NULL;
+      free(n);
+    }
+    return;
+  }
+
+  int max = n->is_leaf ? ROWS_LEAF_MAX : ROWS_NODE_MAX;
+  if (n->n >= max / 4) return;
+
+  int i = rowsChildIndex(p, n);
+  struct rowNode *left, *right;
+
+  if (i + 1 < p->hdr.n){
+    left = n;
+    right = p->child[i + 1];
+  } else if (i > 0){
+    left = p->child[i - 1];
+    right = n;
+  } else if (n->n == 0){
+    if (n->is_leaf) rowsUnlinkLeaf((struct rowLeaf *)n);
+    p->hdr.n = 0;
+    free(n);
+    rowsRebalance(t, &p->hdr);
+    return;
+  } else {
+    return;
+  }
+
+  if (left->n + right->n > max) return;
+
+  if (left->is_leaf){
+    struct rowLeaf *l = (struct rowLeaf *)left, *r = (struct rowLeaf *)right;
+    memcpy(&l->rows[l->hdr.n], r->rows, sizeof(erow) * r->hdr.n);
+    rowsUnlinkLeaf(r);
+  } else {
+    struct rowInner *l = (struct rowInner *)left, *r = (struct rowInner *)right;
+    memcpy(&l->child[l->hdr.n], r->child, sizeof(struct rowNode *) * r->hdr.n);
+    for (int j = 0; j < r->hdr.n; j++) r->child[j]->parent = left;
+  }
+  left->n += right->n;
+  left->count += right->count;
+
+  i = rowsChildIndex(p, right);
+  memmove(&p->child[i], &p->child[i + 1], sizeof(struct rowNode *) * (p->hdr.n - i - 1));
+  p->hdr.n--;
+  free(right);
+
+  rowsRebalance(t, &p->hdr);
+}
+
+void rowsInit(struct rowTree *t){
+  t->root = NULL;
+}
+
+void rowsFree(struct rowTree *t){
+  if (t->root != NULL) rowsFreeNode(t->root);
+  t->root = NULL;
+}
+
+int rowsCount(struct rowTree *t){
+  return t->root ? t->root->count : 0;
+}
+
+erow *rowsAt(struct rowTree *t, int at){
+  if (at < 0 || at >= rowsCount(t)) return NULL;
+  struct rowLeaf *l = rowsFind(t, &at, 0);
+  return &l->rows[at];
+}
+
+/* opens a zeroed row slot at position at and returns it */
+erow *rowsInsert(struct rowTree *t, int at){
+  if (at < 0 || at > rowsCount(t)) return NULL;
+  if (t->root == NULL) t->root = &rowsNewLeaf()->hdr;
+
+  struct rowLeaf *l = rowsFind(t, &at, 1);
+
+  if (l->hdr.n == ROWS_LEAF_MAX){
+    struct rowLeaf *r = rowsNewLeaf();
+    int split = (at == l->hdr.n) ? at : l->hdr.n / 2;
+    r->hdr.n = r->hdr.count = l->hdr.n - split;
+    memcpy(r->rows, &l->rows[split], sizeof(erow) * r->hdr.n);
+    l->hdr.n = l->hdr.count = split;
+
+    r->prev = l;
+    r->next = l->next;
+    if (r->next) r->next->prev = r;
+    l->next = r;
+
+    rowsInsertNode(t, &l->hdr, &r->hdr);
+    if (at >= split){
+      at -= split;
+      l = r;
+    }
+  }
+
+  memmove(&l->rows[at + 1], &l->rows[at], sizeof(erow) * (l->hdr.n - at));
+  memset(&l->rows[at], 0, sizeof(erow));
+  l->hdr.n++;
+  rowsAddCount(&l->hdr, 1);
+
+  return &l->rows[at];
+}
+
+/* opens up to *n zeroed row slots after the last row, all in one leaf, and returns
+   the first of them. *n is set to how many it opened */
+erow *rowsAppend(struct rowTree *t, int *n){
+  if (t->root == NULL) t->root = &rowsNewLeaf()->hdr;
+
+  int at = rowsCount(t);
+  struct rowLeaf *l = rowsFind(t, &at, 1);
+
+  if (l->hdr.n == ROWS_LEAF_MAX){
+    struct rowLeaf *r = rowsNewLeaf();
+    r->prev = l;
+    r->next = l->next;
+    if (r->next) r->next->prev = r;
+    l->next = r;
+    rowsInsertNode(t, &l->hdr, &r->hdr);
+    l = r;
+  }
+
+  int k = ROWS_LEAF_MAX - l->hdr.n;
+  if (k > *n) k = *n;
+  erow *first = &l->rows[l->hdr.n];
+  memset(first, 0, sizeof(erow) * k);
+  l->hdr.n += k;
+  rowsAddCount(&l->hdr, k);
+
+  *n = k;
+  return first;
+}
+
+/* removes the row slot at position at, the caller frees its contents first */
+void rowsDelete(struct rowTree *t, int at){
+  if (at < 0 || at >= rowsCount(t)) return;
+
+  struct rowLeaf *l = rowsFind(t, &at, 0);
+  memmove(&l->rows[at], &l->rows[at + 1], sizeof(erow) * (l->hdr.n - at - 1));
+  l->hdr.n--;
+  rowsAddCount(&l->hdr, -1);
+
+  rowsRebalance(t, &l->hdr);
+}
+
+void rowsIterAt(struct rowTree *t, struct rowIter *it, int at){
+  it->leaf = NULL;
+  it->i = 0;
+  if (at < 0 || at >= rowsCount(t)) return;
+  it->leaf = rowsFind(t, &at, 0);
+  it->i = at;
+}
+
+erow *rowsIterNext(struct rowIter *it){
+  while (it->leaf != NULL && it->i >= it->leaf->hdr.n){
+    it->leaf = it->leaf->next;
+    it->i = 0;
+  }
+  if (it->leaf == NULL) return NULL;
+  return &it->leaf->rows[it->i++];
+}
+
+/* returns the row the iterator is at and steps back, for walking upwards from rowsIterAt */
+erow *rowsIterPrev(struct rowIter *it){
+  while (it->leaf != NULL && it->i < 0){
+    it->leaf = it->leaf->prev;
+    if (it->leaf) it->i = it->leaf->hdr.n - 1;
+  }
+  if (it->leaf == NULL) return NULL;
+  return &it->leaf->rows[it->i--];
+}
@@ -0,0 +1,53 @@
+#ifndef ROWS_H
+#define ROWS_H
+
+  typedef struct {
+    int size;
+    int render_size;
+    char *chars;
+    char *render;                   // NULL until the row is shown or edited
+    unsigned char *hl;
+    unsigned int used;              // frame the render was last drawn or built in
+    unsigned char hl_entry;         // comment state the row was last lexed from
+    unsigned char hl_open_comment;  // comment state at the end of the row
+    unsigned char flags;
+  } erow;
+
+  #define ROW_MAPPED       (1<<0)  // chars points into the file mapping, not owned
+  #define ROW_HL_VALID     (1<<1)  // hl_open_comment is up to date
+  #define ROW_RENDER_ALIAS (1<<2)  // no tabs: render is chars itself
+  #define ROW_HL_MARKS     (1<<3)  // hl is followed by the marks editorRowPatch restarts lexing from
+
+  /*
+    Rows live in a counted B+tree: leaves hold the erow structs inline,
+    inner nodes keep the number of rows below each child, so a row is
+    found by its line number in O(log n) and nothing is renumbered on
+    insert or delete. An erow pointer stays valid only until the next
+    rowsInsert/rowsAppend/rowsDelete.
+  */
+
+  struct rowNode;
+  struct rowLeaf;
+
+  struct rowTree {
+    struct rowNode *root;
+  };
+
+  struct rowIter {
+    struct rowLeaf *leaf;
+    int i;
+  };
+
+  void rowsInit(struct rowTree *t);
+  void rowsFree(struct rowTree *t);
+  int rowsCount(struct rowTree *t);
+  erow *rowsAt(struct rowTree *t, int at);
+  erow *rowsInsert(struct rowTree *t, int at);
+  erow *rowsAppend(struct rowTree *t, int *n);
+  void rowsDelete(struct rowTree *t, int at);
+
+  void rowsIterAt(struct rowTree *t, struct rowIter *it, int at);
+  erow *rowsIterNext(struct rowIter *it);
+  erow *rowsIterPrev(struct rowIter *it);
+
+#endif // !ROWS_H
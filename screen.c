@@ -0,0 +1,342 @@
+#include "screen.h"
+#include "errors.h"
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* equal cells shorter than this between two changes are rewritten instead of jumped over */
+#define SCREEN_GAP 6
+#define SGR_MAX 20  // longest SGR parameter of a color, 48;2;255;255;255
+
+/* the SGR parameters that select a theme color */
+struct sgr {
+  char s[SGR_MAX];
+  int len;
+};
+
+struct screen {
+  int rows, cols;
+  cell *front;        // what the terminal shows
+  cell *back;         // frame being drawn
+  int valid;          // front is known to match the terminal
+  int y, x;           // write position in back
+  cell pen;
+  int term_y, term_x; // terminal cursor, -1 when unknown
+  cell term_pen;
+  int scroll_top, scroll_bottom, scroll_n;  // rows the next flush scrolls first
+  struct sgr fg[SCREEN_COLORS], bg[SCREEN_COLORS];  // 0 holds the defaults, 39 and 49
+} Screen;
+
+static const cell BLANK = {' ', 0, 0, 0};
+
+/* makes room for len more bytes and returns where they go, NULL when out of memory */
+char *abReserve(struct abuf *ab, int len){
+  if (ab->len + len > ab->cap){
+    int cap = ab->cap ? ab->cap : 4096;
+    while (cap < ab->len + len) cap *= 2;
+    char *new = realloc(ab->b, cap);
+    if (new == NULL) return NULL;
+    ab->b = new;
+    ab->cap = cap;
+  }
+  return &ab->b[ab->len];
+}
+
+void abAppend(struct abuf *ab, const char *s, int len){
+  char *dst = abReserve(ab, len);
+
+  if (dst == NULL) return;
+  memcpy(dst, s, len);
+  ab->len += len;
+}
+
+void abReset(struct abuf *ab){
+  ab->len = 0;
+}
+
+/* sends the whole buffer, retrying short writes */
+int abWrite(struct abuf *ab, int fd){
+  int off = 0;
+  while (off < ab->len){
+    ssize_t n = write(fd, &ab->b[off], ab->len - off);
+    if (n == -1){
+      if (errno == EINTR || errno == EAGAIN) continue;
+      return -1;
+    }
+    off += n;
+  }
+  return off;
+}
+
+void abFree(struct abuf *ab){
+  free(ab->b);
+  ab->b = NULL;
+  ab->len = ab->cap = 0;
+}
+
+static int cellEqual(cell a, cell b){
+  return a.ch == b.ch && a.fg == b.fg && a.bg == b.bg && a.attr == b.attr;
+}
+
+static int penEqual(cell a, cell b){
+  return a.fg == b.fg && a.bg == b.bg && a.attr == b.attr;
+}
+
+/* a row holding part of a multibyte character, past which cells and terminal columns part ways */
+static int screenRowWide(cell *row, int n){
+  for (int i = 0; i < n; i++){
+    if ((unsigned char)row[i].ch >= 0x80) return 1;
+  }
+  return 0;
+}
+
+static void screenFill(cell *c, int n){
+  for (int i = 0; i < n; i++) c[i] = BLANK;
+}
+
+/* starts a new frame: the back grid is cleared and the pen reset */
+void screenBegin(int rows, int cols){
+  if (rows != Screen.rows || cols != Screen.cols){
+    Screen.front = realloc(Screen.front, sizeof(cell) * rows * cols);
+    Screen.back = realloc(Screen.back, sizeof(cell) * rows * cols);
+    if (Screen.front == NULL || Screen.back == NULL) die("realloc");
+    Screen.rows = rows;
+    Screen.cols = cols;
+    Screen.valid = 0;
+  }
+
+  screenFill(Screen.back, rows * cols);
+  Screen.y = Screen.x = 0;
+  Screen.pen = BLANK;
+}
+
+void screenMove(int y, int x){
+  Screen.y = y;
+  Screen.x = x;
+}
+
+void screenNewline(){
+  Screen.y++;
+  Screen.x = 0;
+}
+
+void screenPen(int fg, int bg, int attr){
+  Screen.pen.fg = fg;
+  Screen.pen.bg = bg;
+  Screen.pen.attr = attr;
+}
+
+/* writes text at the current position with the current pen, clipping at the edges */
+void screenAppend(const char *s, int len){
+  if (Screen.y < 0 || Screen.y >= Screen.rows) return;
+  cell *row = &Screen.back[Screen.y * Screen.cols];
+
+  for (int i = 0; i < len; i++, Screen.x++){
+    if (Screen.x < 0 || Screen.x >= Screen.cols) continue;
+    row[Screen.x] = Screen.pen;
+    row[Screen.x].ch = s[i];
+  }
+}
+
+/* the next flush first scrolls rows top to bottom - 1 by n lines, up for n > 0, in the terminal
+   and in front, leaving only the rows scrolled in and the cells that changed otherwise to send */
+void screenScroll(int top, int bottom, int n){
+  Screen.scroll_top = top;
+  Screen.scroll_bottom = bottom;
+  Screen.scroll_n = n;
+}
+
+/* how many colors the terminal shows, going by COLORTERM and TERM */
+int screenColorDepth(){
+  char *colorterm = getenv("COLORTERM"), *term = getenv("TERM");
+
+  if (colorterm != NULL && (strstr(colorterm, "truecolor") || strstr(colorterm, "24bit"))) return SCREEN_TRUECOLOR;
+  if (term != NULL && strstr(term, "256color")) return SCREEN_256;
+  return SCREEN_ANSI;
+}
+
+static void screenSgr(struct sgr *sgr, const struct screenColor *c, int depth, int background){
+  if (depth == SCREEN_TRUECOLOR){
+    sgr->len = snprintf(sgr->s, SGR_MAX, "%d;2;%d;%d;%d", background ? 48 : 38, c->r, c->g, c->b);
+  } else if (depth == SCREEN_256){
+    sgr->len = snprintf(sgr->s, SGR_MAX, "%d;5;%d", background ? 48 : 38, c->index);
+  } else {
+    sgr->len = snprintf(sgr->s, SGR_MAX, "%d", c->ansi + (background ? 10 : 0));
+  }
+}
+
+/* builds the escape strings of colors 1 to n for terminals of the given depth */
+void screenTheme(const struct screenColor *colors, int n, int depth){
+  if (n > SCREEN_COLORS - 1) n = SCREEN_COLORS - 1;
+
+  Screen.fg[0].len = snprintf(Screen.fg[0].s, SGR_MAX, "39");
+  Screen.bg[0].len = snprintf(Screen.bg[0].s, SGR_MAX, "49");
+  for (int i = 0; i < n; i++){
+    screenSgr(&Screen.fg[i + 1], &colors[i], depth, 0);
+    screenSgr(&Screen.bg[i + 1], &colors[i], depth, 1);
+  }
+  Screen.valid = 0;
+}
+
+/* forgets what the terminal shows, the next flush repaints everything */
+void screenInvalidate(){
+  Screen.valid = 0;
+}
+
+static void screenEmitMove(struct abuf *ab, int y, int x){
+  if (Screen.term_y == y && Screen.term_x == x) return;
+
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+  abAppend(ab, buf, len);
+  Screen.term_y = y;
+  Screen.term_x = x;
+}
+
+static int screenSgrAppend(char *buf, int len, const char *s, int n){
+  if (len > 2) buf[len++] = ';';
+  memcpy(&buf[len], s, n);
+  return len + n;
+}
+
+/* changes only what differs from the terminal's pen, or resets it when going back to the default takes more */
+static void screenEmitPen(struct abuf *ab, cell pen){
+  cell term = Screen.term_pen;
+  if (penEqual(pen, term)) return;
+
+  char buf[2 * SGR_MAX + 16] = "\x1b[";
+  int len = 2, parts = 0;
+  if (pen.fg != term.fg){
+    len = screenSgrAppend(buf, len, Screen.fg[pen.fg].s, Screen.fg[pen.fg].len);
+    parts++;
+  }
+  if (pen.bg != term.bg){
+    len = screenSgrAppend(buf, len, Screen.bg[pen.bg].s, Screen.bg[pen.bg].len);
+    parts++;
+  }
+  if ((pen.attr ^ term.attr) & SCREEN_REVERSE){
+    len = screenSgrAppend(buf, len, pen.attr & SCREEN_REVERSE ? "7" : "27", pen.attr & SCREEN_REVERSE ? 1 : 2);
+    parts++;
+  }
+  if (parts > 1 && penEqual(pen, BLANK)) len = 2;
+  buf[len++] = 'm';
+
+  abAppend(ab, buf, len);
+  Screen.term_pen = pen;
+}
+
+static void screenEmitCells(struct abuf *ab, int y, int from, int to){
+  cell *row = &Screen.back[y * Screen.cols];
+
+  screenEmitMove(ab, y, from);
+  int x = from;
+  while (x < to){
+    screenEmitPen(ab, row[x]);
+
+    int end = x + 1;
+    while (end < to && penEqual(row[end], row[x])) end++;
+
+    char *dst = abReserve(ab, end - x);
+    if (dst == NULL) return;
+    for (int i = x; i < end; i++) *dst++ = row[i].ch;
+    ab->len += end - x;
+    x = end;
+  }
+
+  // past the last column the cursor waits for a wrap, its position is not reliable
+  Screen.term_x = to < Screen.cols ? to : -1;
+  if (Screen.term_x == -1) Screen.term_y = -1;
+}
+
+/* scrolls inside a region set with DECSTBM, SU and SD fill the rows they expose with the pen */
+static void screenEmitScroll(struct abuf *ab){
+  int top = Screen.scroll_top, bottom = Screen.scroll_bottom, n = Screen.scroll_n;
+  int lines = n > 0 ? n : -n, keep = bottom - top - lines;
+
+  Screen.scroll_n = 0;
+  if (n == 0 || top < 0 || bottom > Screen.rows || keep <= 0) return;
+
+  char buf[48];
+  screenEmitPen(ab, BLANK);
+  int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dr\x1b[%d%c\x1b[r", top + 1, bottom, lines, n > 0 ? 'S' : 'T');
+  abAppend(ab, buf, len);
+  // setting the region homes the cursor
+  Screen.term_y = Screen.term_x = 0;
+
+  cell *region = &Screen.front[top * Screen.cols];
+  if (n > 0){
+    memmove(region, &region[lines * Screen.cols], sizeof(cell) * keep * Screen.cols);
+    screenFill(&region[keep * Screen.cols], lines * Screen.cols);
+  } else {
+    memmove(&region[lines * Screen.cols], region, sizeof(cell) * keep * Screen.cols);
+    screenFill(region, lines * Screen.cols);
+  }
+}
+
+/* sends the difference between the frame just drawn and the previous one */
+void screenFlush(struct abuf *ab){
+  if (!Screen.valid){
+    abAppend(ab, "\x1b[m\x1b[2J", 7);
+    screenFill(Screen.front, Screen.rows * Screen.cols);
+    Screen.term_pen = BLANK;
+    Screen.term_y = Screen.term_x = -1;
+    Screen.valid = 1;
+    Screen.scroll_n = 0;
+  }
+  screenEmitScroll(ab);
+
+  for (int y = 0; y < Screen.rows; y++){
+    cell *front = &Screen.front[y * Screen.cols];
+    cell *back = &Screen.back[y * Screen.cols];
+
+    int back_end = Screen.cols;
+    while (back_end > 0 && cellEqual(back[back_end - 1], BLANK)) back_end--;
+    int front_end = Screen.cols;
+    while (front_end > 0 && cellEqual(front[front_end - 1], BLANK)) front_end--;
+
+    // the column a cell lands on is only known up to the first multibyte character,
+    // a row that has one is sent whole when it changes and cleared after
+    if (screenRowWide(back, back_end) || screenRowWide(front, front_end)){
+      int x = 0;
+      while (x < Screen.cols && cellEqual(front[x], back[x])) x++;
+      if (x < Screen.cols){
+        screenEmitCells(ab, y, 0, back_end);
+        screenEmitPen(ab, BLANK);
+        abAppend(ab, "\x1b[K", 3);
+        Screen.term_y = Screen.term_x = -1;
+      }
+      memcpy(front, back, sizeof(cell) * Screen.cols);
+      continue;
+    }
+
+    int x = 0;
+    while (x < back_end){
+      if (cellEqual(front[x], back[x])){
+        x++;
+        continue;
+      }
+
+      int last = x;
+      for (int j = x + 1; j < back_end && j - last <= SCREEN_GAP; j++){
+        if (!cellEqual(front[j], back[j])) last = j;
+      }
+      screenEmitCells(ab, y, x, last + 1);
+      x = last + 1;
+    }
+
+    if (front_end > back_end){
+      screenEmitMove(ab, y, back_end);
+      screenEmitPen(ab, BLANK);
+      abAppend(ab, "\x1b[K", 3);
+    }
+
+    memcpy(front, back, sizeof(cell) * Screen.cols);
+  }
+}
+
+/* parks the terminal cursor, nothing is sent when it is already there */
+void screenCursor(struct abuf *ab, int y, int x){
+  screenEmitMove(ab, y, x);
+}
@@ -0,0 +1,66 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+  /* append buffer, kept across frames so its capacity is reused */
+  struct abuf {
+    char* b;
+    int len;
+    int cap;
+  };
+
+  #define ABUF_INIT {NULL, 0, 0};
+
+  char *abReserve(struct abuf *ab, int len);
+  void abAppend(struct abuf *ab, const char *s, int len);
+  void abReset(struct abuf *ab);
+  int abWrite(struct abuf *ab, int fd);
+  void abFree(struct abuf *ab);
+
+  /*
+    The frame is drawn into a grid of cells and compared with the grid the
+    terminal already shows, only the cells that changed are sent out. A
+    region whose text moved up or down is scrolled in the terminal first.
+  */
+
+  #define SCREEN_REVERSE (1<<0)
+  #define SCREEN_COLORS 64
+
+  typedef struct {
+    char ch;
+    unsigned char fg;    // theme color, 0 for the terminal default
+    unsigned char bg;    // theme color, 0 for the terminal default
+    unsigned char attr;
+  } cell;
+
+  /*
+    A theme lists its colors as all three kinds of terminal know them, the
+    escape strings for the kind in use are built once when it is set. Cells
+    name colors by their position in the theme, starting at 1.
+  */
+
+  enum screenDepth {
+    SCREEN_ANSI,       // the 16 colors of SGR 30-37 and 90-97
+    SCREEN_256,
+    SCREEN_TRUECOLOR
+  };
+
+  struct screenColor {
+    unsigned char ansi;  // SGR foreground code, the background one is 10 more
+    unsigned char index; // 256 color palette
+    unsigned char r, g, b;
+  };
+
+  int screenColorDepth();
+  void screenTheme(const struct screenColor *colors, int n, int depth);
+
+  void screenBegin(int rows, int cols);
+  void screenMove(int y, int x);
+  void screenNewline();
+  void screenPen(int fg, int bg, int attr);
+  void screenAppend(const char *s, int len);
+  void screenFlush(struct abuf *ab);
+  void screenCursor(struct abuf *ab, int y, int x);
+  void screenScroll(int top, int bottom, int n);
+  void screenInvalidate();
+
+#endif // !SCREEN_H
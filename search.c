@@ -0,0 +1,111 @@
+#define _GNU_SOURCE
+
+#include "search.h"
+#include "regex.h"
+#include "errors.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+int searchCompile(struct searchPattern *p, const char *s, int len){
+  p->s = malloc(len + 1);
+  if (p->s == NULL) die("malloc");
+  memcpy(p->s, s, len);
+  p->s[len] = '\0';
+  p->len = len;
+  p->re = NULL;
+
+  for (int i = 0; i < len; i++){
+    if (s[i] && strchr("\\.^$|?*+()[]{", s[i])){
+      p->re = regexCompile(s, len);
+      if (p->re == NULL){
+        searchFree(p);
+        return -1;
+      }
+      break;
+    }
+  }
+  return 0;
+}
+
+void searchFree(struct searchPattern *p){
+  free(p->s);
+  regexFree(p->re);
+  p->s = NULL;
+  p->len = 0;
+  p->re = NULL;
+}
+
+#ifdef __SSE2__
+/* compares 16 candidate positions at once on their first and last byte,
+   only the positions where both agree are checked in full */
+static char *searchLiteral(const char *pat, int len, char *s, char *end){
+  const __m128i first = _mm_set1_epi8(pat[0]);
+  const __m128i last = _mm_set1_epi8(pat[len - 1]);
+  char *stop = end - len + 1;  // first position a match can no longer start at
+
+  // both loads stay inside [s, end)
+  while (end - s >= 16 + len - 1){
+    __m128i a = _mm_loadu_si128((const __m128i *)s);
+    __m128i b = _mm_loadu_si128((const __m128i *)(s + len - 1));
+    unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                        _mm_cmpeq_epi8(b, last)));
+    while (mask){
+      int bit = __builtin_ctz(mask);
+      if (len <= 2 || !memcmp(s + bit + 1, pat + 1, len - 2)) return s + bit;
+      mask &= mask - 1;
+    }
+    s += 16;
+  }
+
+  for (; s < stop; s++){
+    if (s[0] == pat[0] && s[len - 1] == pat[len - 1] && !memcmp(s, pat, len)) return s;
+  }
+  return NULL;
+}
+#else
+static char *searchLiteral(const char *pat, int len, char *s, char *end){
+  char *stop = end - len + 1;
+
+  while (s < stop){
+    s = memchr(s, pat[0], stop - s);
+    if (s == NULL) return NULL;
+    if (s[len - 1] == pat[len - 1] && !memcmp(s, pat, len)) return s;
+    s++;
+  }
+  return NULL;
+}
+#endif
+
+char *searchNext(struct searchPattern *p, char *s, char *from, char *end, int *match_len){
+  if (p->re) return from <= end ? regexFind(p->re, s, from, end, match_len) : NULL;
+  if (p->len == 0 || end - from < p->len) return NULL;
+
+  char *m = p->len == 1 ? memchr(from, p->s[0], end - from) : searchLiteral(p->s, p->len, from, end);
+  if (m) *match_len = p->len;
+  return m;
+}
+
+/* the last occurrence of pat that starts at or before top, going back with memrchr */
+static char *searchLiteralLast(const char *pat, int len, char *s, char *top, char *end){
+  char *p = top < end - len ? top : end - len;
+
+  while (p >= s){
+    p = memrchr(s, pat[0], p - s + 1);
+    if (p == NULL) return NULL;
+    if (p[len - 1] == pat[len - 1] && !memcmp(p, pat, len)) return p;
+    p--;
+  }
+  return NULL;
+}
+
+char *searchLast(struct searchPattern *p, char *s, char *until, char *end, int *match_len){
+  if (p->re) return regexFindLast(p->re, s, until, end, match_len);
+  if (p->len == 0 || until == s || end - s < p->len) return NULL;
+
+  char *m = searchLiteralLast(p->s, p->len, s, until == end ? end : until - 1, end);
+  if (m) *match_len = p->len;
+  return m;
+}
@@ -0,0 +1,28 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+  /*
+    A compiled search pattern. Text is searched in blocks of whole lines
+    from s to end. searchNext finds the first match that starts in
+    [from, end], searchLast the last one that starts in [s, until), or
+    anywhere when until is end.
+    Matches never run past end and never contain a newline.
+
+    A pattern without regex operators is searched for as a literal, the
+    rest go through regex.c. searchCompile returns -1 on a bad pattern.
+  */
+
+  struct regex;
+
+  struct searchPattern {
+    char *s;
+    int len;
+    struct regex *re;   // NULL for a literal
+  };
+
+  int searchCompile(struct searchPattern *p, const char *s, int len);
+  void searchFree(struct searchPattern *p);
+  char *searchNext(struct searchPattern *p, char *s, char *from, char *end, int *match_len);
+  char *searchLast(struct searchPattern *p, char *s, char *until, char *end, int *match_len);
+
+#endif // !SEARCH_H
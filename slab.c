@@ -0,0 +1,130 @@
+#include "slab.h"
+#include "errors.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SLAB_MIN_SHIFT 4          // the smallest class is 16 bytes
+#define SLAB_LARGE SLAB_CLASSES   // the class word of a block from malloc
+#define SLAB_HEADER sizeof(size_t)
+
+/* the class word ends the struct, so it sits right before the payload as in a small block */
+struct slabLarge {
+  struct slabLarge *prev, *next;
+  size_t size;
+  size_t cls;
+};
+
+static int slabClass(size_t n){
+  int c = 0;
+  while (((size_t)1 << (c + SLAB_MIN_SHIFT)) < n + SLAB_HEADER) c++;
+  return c;
+}
+
+static size_t slabCapacity(void *p){
+  size_t cls = ((size_t *)p)[-1];
+  if (cls == SLAB_LARGE) return ((struct slabLarge *)p - 1)->size;
+  return ((size_t)1 << (cls + SLAB_MIN_SHIFT)) - SLAB_HEADER;
+}
+
+void slabInit(struct slab *s){
+  memset(s, 0, sizeof(*s));
+}
+
+/* frees every block at once */
+void slabRelease(struct slab *s){
+  void *chunk = s->chunks;
+  while (chunk != NULL){
+    void *next = *(void **)chunk;
+    free(chunk);
+    chunk = next;
+  }
+
+  struct slabLarge *l = s->large;
+  while (l != NULL){
+    struct slabLarge *next = l->next;
+    free(l);
+    l = next;
+  }
+  slabInit(s);
+}
+
+void *slabAlloc(struct slab *s, size_t n){
+  int c = slabClass(n);
+  size_t *block;
+
+  if (c >= SLAB_CLASSES){
+    struct slabLarge *l = malloc(sizeof(struct slabLarge) + n);
+    if (l == NULL) die("malloc");
+    l->prev = NULL;
+    l->next = s->large;
+    if (s->large) s->large->prev = l;
+    s->large = l;
+    l->size = n;
+    l->cls = SLAB_LARGE;
+    return l + 1;
+  }
+
+  if (s->free[c] != NULL){
+    block = s->free[c];
+    s->free[c] = *(void **)(block + 1);
+  } else {
+    size_t size = (size_t)1 << (c + SLAB_MIN_SHIFT);
+    if (s->chunk_end - s->chunk < (ptrdiff_t)size){
+      // the rest of the old chunk is too small for this class and is left unused
+      char *chunk = malloc(SLAB_CHUNK);
+      if (chunk == NULL) die("malloc");
+      *(void **)chunk = s->chunks;
+      s->chunks = chunk;
+      s->chunk = chunk + 16;
+      s->chunk_end = chunk + SLAB_CHUNK;
+    }
+    block = (size_t *)s->chunk;
+    s->chunk += size;
+  }
+
+  *block = c;
+  return block + 1;
+}
+
+/* keeps the block while n still fits in it */
+void *slabRealloc(struct slab *s, void *p, size_t n){
+  if (p == NULL) return slabAlloc(s, n);
+
+  size_t cap = slabCapacity(p);
+  if (n <= cap) return p;
+
+  if (((size_t *)p)[-1] == SLAB_LARGE){
+    // with an eighth to spare, a long row growing a byte at a time is not moved every time
+    struct slabLarge *l = (struct slabLarge *)p - 1;
+    size_t size = n + n / 8;
+    l = realloc(l, sizeof(struct slabLarge) + size);
+    if (l == NULL) die("realloc");
+    l->size = size;
+    if (l->prev) l->prev->next = l;
+    else s->large = l;
+    if (l->next) l->next->prev = l;
+    return l + 1;
+  }
+
+  void *q = slabAlloc(s, n);
+  memcpy(q, p, cap);
+  slabFree(s, p);
+  return q;
+}
+
+void slabFree(struct slab *s, void *p){
+  if (p == NULL) return;
+
+  size_t *block = (size_t *)p - 1;
+  if (*block == SLAB_LARGE){
+    struct slabLarge *l = (struct slabLarge *)p - 1;
+    if (l->prev) l->prev->next = l->next;
+    else s->large = l->next;
+    if (l->next) l->next->prev = l->prev;
+    free(l);
+    return;
+  }
+
+  *(void **)p = s->free[*block];
+  s->free[*block] = block;
+}
@@ -0,0 +1,34 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+  #include <stddef.h>
+
+  /*
+    Row text, renders and hl of a buffer come from one slab. Blocks are
+    cut from large chunks in power of two size classes, a freed block goes
+    on the free list of its class for the next allocation of that size,
+    and closing the buffer drops everything at once. Blocks past the
+    largest class come from malloc and are kept on a list for the same
+    reason. Every block starts with a word naming its class, so frees and
+    reallocs need no size.
+  */
+
+  #define SLAB_CLASSES 9        // 16 to 4096 byte blocks, the header included
+  #define SLAB_CHUNK (1<<20)
+
+  struct slabLarge;
+
+  struct slab {
+    void *free[SLAB_CLASSES];
+    char *chunk, *chunk_end;    // what is left of the newest chunk
+    void *chunks;               // every chunk, linked through their first word
+    struct slabLarge *large;
+  };
+
+  void slabInit(struct slab *s);
+  void slabRelease(struct slab *s);
+  void *slabAlloc(struct slab *s, size_t n);
+  void *slabRealloc(struct slab *s, void *p, size_t n);
+  void slabFree(struct slab *s, void *p);
+
+#endif // !SLAB_H
@@ -0,0 +1,297 @@
+/*
+
+ Corvux tests
+
+ Drives the editor core without a terminal and checks the rows it ends
+ up with, for bugs that once got through.
+
+ make test
+
+*/
+
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include "editor.h"
+#include "errors.h"
+#include "lexer.h"
+#include "screen.h"
+#include "search.h"
+#include "undo.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_ROWS 24
+#define TEST_COLS 80
+
+static int failed = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)){ \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+      failed++; \
+    } \
+  } while (0)
+
+/*  helpers  */
+
+static char path[] = "/tmp/corvux-test-XXXXXX.c";
+
+/* opens text as a C file with every row loaded, and rendered and lexed when render is set */
+static void testOpen(const char *text, int render){
+  int fd = mkstemps(path, 2);
+  if (fd == -1) die("mkstemps");
+  if (write(fd, text, strlen(text)) != (ssize_t)strlen(text)) die("write");
+  close(fd);
+
+  initEditorSize(TEST_ROWS, TEST_COLS);
+  editorOpen(path);
+  editorLoadUntil(1 << 30);
+  if (render) for (int i = 0; i < editorNumRows(); i++) editorUpdateRow(i);
+  unlink(path);
+  strcpy(path, "/tmp/corvux-test-XXXXXX.c");
+}
+
+/*  tests  */
+
+/* a row put back right above the last one carries its open comment down to it */
+static void testInsertAboveLast(){
+  testOpen("int a;\n/* b\nint c;", 1);
+  CHECK(editorRowAt(2)->hl_entry == 1);
+
+  editorDeleteRow(1);
+  CHECK(editorRowAt(1)->hl_entry == 0);
+
+  editorInsertRow("/* b", 1, 4);
+  CHECK(editorRowAt(2)->hl_entry == 1);
+  CHECK(editorRowAt(2)->hl_open_comment == 1);
+}
+
+/* a row with tabs ends in the same comment state before and after it is rendered */
+static void testLexTabs(){
+  testOpen("/*\n\t*/123/*//\nint c;", 0);
+  editorUpdateSyntax(2);
+  int exit = editorRowAt(1)->hl_open_comment;
+  CHECK(editorRowAt(2)->hl_entry == exit);
+
+  editorUpdateRow(1);
+  CHECK(editorRowAt(1)->hl_open_comment == exit);
+  editorUpdateSyntax(2);
+  CHECK(editorRowAt(2)->hl_entry == exit);
+}
+
+/* a changed row with a multibyte character is sent from its first column, the bytes before
+   the change do not say which column it is on */
+static void testScreenUtf8(){
+  struct abuf ab = ABUF_INIT;
+  const char *sent = "\x1b[1;1H\xc3\xa9tas\x1b[K";
+
+  screenTheme(NULL, 0, SCREEN_ANSI);
+  screenInvalidate();
+  screenBegin(2, 10);
+  screenAppend("\xc3\xa9tat", 5);
+  screenFlush(&ab);
+
+  abReset(&ab);
+  screenBegin(2, 10);
+  screenAppend("\xc3\xa9tas", 5);
+  screenFlush(&ab);
+  CHECK(memmem(ab.b, ab.len, sent, strlen(sent)) != NULL);
+  abFree(&ab);
+}
+
+/* a group larger than the limit stays whole until the next one replaces it */
+static void testUndoTrim(){
+  struct undoLog log;
+  int n = 0;
+
+  undoInit(&log, 256);
+  undoBreak(&log);
+  for (int i = 0; i < 20; i++) undoRecord(&log, UNDO_INSERT, i, 0, "text", 4);
+  while (undoPrev(&log) != NULL) n++;
+  CHECK(n == 20);
+  while (undoNext(&log) != NULL);
+
+  undoBreak(&log);
+  for (int i = 0; i < 3; i++) undoRecord(&log, UNDO_INSERT, i, 0, "more", 4);
+  CHECK(log.count - log.first == 3);
+  CHECK(log.ops[log.first].flags & UNDO_GROUP);
+  undoFree(&log);
+}
+
+/* a long row patched around each edit ends up with the hl a full lex gives it */
+static void testPatchLongRow(){
+  char text[8192];
+  int len = 0;
+  while (len < 6000) len += sprintf(&text[len], "int a%d = \"s\";\t/* c */ ", len);
+  testOpen(text, 1);
+
+  static unsigned char hl[16384];
+  const char keys[] = "/*\"\t x";
+  int same = 1;
+  srand(1);
+  for (int i = 0; i < 400; i++){
+    erow *row = editorRowAt(0);
+    int at = rand() % row->size;
+    if (rand() % 3) editorRowInsertChar(0, at, keys[rand() % (sizeof(keys) - 1)]);
+    else editorRowDeleteChar(0, at);
+
+    row = editorRowAt(0);
+    int n = row->render_size;
+    memcpy(hl, row->hl, n);
+    editorUpdateRow(0);
+    if (editorRowAt(0)->render_size != n || memcmp(hl, editorRowAt(0)->hl, n)) same = 0;
+  }
+  CHECK(same);
+}
+
+/* a file cut short by another program while mapped loads on instead of faulting */
+static void testTruncatedMap(){
+  char line[] = "int truncated;\n";
+  int fd = mkstemps(path, 2);
+  if (fd == -1) die("mkstemps");
+  for (int i = 0; i < 100000; i++){
+    if (write(fd, line, sizeof(line) - 1) != sizeof(line) - 1) die("write");
+  }
+  close(fd);
+
+  initEditorSize(TEST_ROWS, TEST_COLS);
+  editorOpen(path);
+  int loaded = editorNumRows();
+  CHECK(truncate(path, 0) == 0);
+  editorLoadUntil(1 << 30);
+  CHECK(editorNumRows() > loaded);
+  CHECK(editorRowAt(0)->size == 14);
+
+  unlink(path);
+  strcpy(path, "/tmp/corvux-test-XXXXXX.c");
+}
+
+/* saving a file cut short while mapped writes what is left of it, not the zeros past its end.
+   with rows loaded from past the cut, and through the in-place save of a hard-linked file */
+static void testTruncatedSave(int rows, int linked){
+  char line[] = "int truncated;\n", other[64], buf[4096];
+  int fd = mkstemps(path, 2);
+  if (fd == -1) die("mkstemps");
+  for (int i = 0; i < 20000; i++){
+    if (write(fd, line, sizeof(line) - 1) != sizeof(line) - 1) die("write");
+  }
+  close(fd);
+  snprintf(other, sizeof(other), "%s.link", path);
+  if (linked && link(path, other) == -1) die("link");
+
+  initEditorSize(TEST_ROWS, TEST_COLS);
+  editorOpen(path);
+  editorLoadUntil(rows);
+  CHECK(truncate(path, 40000) == 0);
+  editorSave(NULL);
+
+  size_t total = 0, nul = 0;
+  ssize_t n;
+  fd = open(path, O_RDONLY);
+  while ((n = read(fd, buf, sizeof(buf))) > 0){
+    total += n;
+    if (memchr(buf, '\0', n) != NULL) nul++;
+  }
+  close(fd);
+  CHECK(nul == 0);
+  CHECK(total > 39000 && total <= 40001);
+
+  unlink(other);
+  unlink(path);
+  strcpy(path, "/tmp/corvux-test-XXXXXX.c");
+}
+
+/* Esc typed while the answer to a frame is on its way reads as Esc, the answer as no key at all */
+static void testEscBeforeAnswer(){
+  const char keys[] = "\x1b\x1b[0nX";
+  int fds[2], in = dup(STDIN_FILENO);
+
+  if (pipe(fds) == -1) die("pipe");
+  if (write(fds[1], keys, sizeof(keys) - 1) != sizeof(keys) - 1) die("write");
+  close(fds[1]);
+  dup2(fds[0], STDIN_FILENO);
+  close(fds[0]);
+
+  CHECK(editorReadKey() != 'X');
+  CHECK(editorReadKey() == 'X');
+
+  dup2(in, STDIN_FILENO);
+  close(in);
+}
+
+/* the last match found in one scan back is the last one a walk forward over every match finds */
+static void testSearchLast(){
+  static const char *patterns[] = {"ab", "abcd|c", "c|bcdef|abcd", "a*", "^a", "a$", "^$", "(a|ab)(c|bcd)", "b.*c", "ba*$"};
+  char text[64];
+  int same = 1;
+
+  srand(1);
+  for (int i = 0; i < 5000; i++){
+    int n = rand() % 40;
+    for (int j = 0; j < n; j++) text[j] = "aabbcd\n\r"[rand() % 8];
+    const char *pattern = patterns[rand() % (sizeof(patterns) / sizeof(patterns[0]))];
+    struct searchPattern p;
+    if (searchCompile(&p, pattern, strlen(pattern)) == -1) die("searchCompile");
+
+    char *until = text + rand() % (n + 1), *end = text + n, *want = NULL, *m, *from = text;
+    int len, want_len = 0, all = until == end;
+    while ((from < until || (all && from == end)) &&
+           (m = searchNext(&p, text, from, end, &len)) != NULL && (m < until || all)){
+      want = m;
+      want_len = len;
+      from = m + 1;
+    }
+    m = searchLast(&p, text, until, end, &len);
+    if (m != want || (m && len != want_len)) same = 0;
+    searchFree(&p);
+  }
+  CHECK(same);
+}
+
+/* a save keeps the file's owner, which only shows when run as root */
+static void testSaveOwner(){
+  char name[] = "/tmp/corvux-test-XXXXXX.c";
+  struct stat st;
+
+  testOpen("int owned;\n", 1);
+  int fd = mkstemps(name, 2);
+  if (fd == -1) die("mkstemps");
+  close(fd);
+  if (geteuid() == 0 && chown(name, 65534, 65534) == -1) die("chown");
+  uid_t uid = geteuid() == 0 ? 65534 : geteuid();
+
+  editorRowInsertChar(0, 0, 'x');
+  editorSave(name);
+  CHECK(stat(name, &st) == 0 && st.st_uid == uid);
+
+  unlink(name);
+}
+
+int main(){
+  initLexer();
+
+  testInsertAboveLast();
+  testLexTabs();
+  testScreenUtf8();
+  testUndoTrim();
+  testPatchLongRow();
+  testTruncatedMap();
+  testTruncatedSave(100, 0);
+  testTruncatedSave(5000, 0);
+  testTruncatedSave(100, 1);
+  testTruncatedSave(5000, 1);
+  testEscBeforeAnswer();
+  testSearchLast();
+  testSaveOwner();
+
+  editorFree();
+  if (failed) fprintf(stderr, "%d checks failed\n", failed);
+  else printf("all tests passed\n");
+  return failed != 0;
+}
@@ -0,0 +1,140 @@
+#include "undo.h"
+#include "errors.h"
+#include <stdlib.h>
+#include <string.h>
+
+void undoInit(struct undoLog *log, size_t limit){
+  log->ops = NULL;
+  log->first = log->cur = log->count = log->cap = 0;
+  log->text = NULL;
+  log->text_first = log->text_len = log->text_cap = 0;
+  log->limit = limit;
+  log->group = 1;
+  log->last = 0;
+}
+
+void undoFree(struct undoLog *log){
+  free(log->ops);
+  free(log->text);
+  undoInit(log, log->limit);
+}
+
+/* the next op starts a new group */
+void undoBreak(struct undoLog *log){
+  log->group = 1;
+}
+
+static void undoAppendText(struct undoLog *log, const char *s, int len){
+  if (log->text_len + len > log->text_cap){
+    size_t cap = log->text_cap ? log->text_cap : 4096;
+    while (cap < log->text_len + len) cap *= 2;
+    log->text = realloc(log->text, cap);
+    if (log->text == NULL) die("realloc");
+    log->text_cap = cap;
+  }
+  memcpy(&log->text[log->text_len], s, len);
+  log->text_len += len;
+}
+
+/* moves what is left after dropping old ops back to the start of both arrays */
+static void undoCompact(struct undoLog *log){
+  int n = log->count - log->first;
+  memmove(log->ops, &log->ops[log->first], sizeof(struct undoOp) * n);
+  memmove(log->text, &log->text[log->text_first], log->text_len - log->text_first);
+  for (int i = 0; i < n; i++) log->ops[i].text -= log->text_first;
+
+  log->cur -= log->first;
+  log->last -= log->first;
+  log->count = n;
+  log->first = 0;
+  log->text_len -= log->text_first;
+  log->text_first = 0;
+}
+
+/* drops the oldest groups until the log fits in its limit, never the newest one:
+   it may still be growing, and a group is only ever undone whole */
+static void undoTrim(struct undoLog *log){
+  while (log->first < log->last &&
+         sizeof(struct undoOp) * (log->count - log->first) + log->text_len - log->text_first > log->limit){
+    do log->first++;
+    while (log->first < log->last && !(log->ops[log->first].flags & UNDO_GROUP));
+    log->text_first = log->ops[log->first].text;
+  }
+
+  if (log->first * 2 >= log->cap) undoCompact(log);
+}
+
+/* adds an edit to the log, merging it into the last op when it continues it */
+void undoRecord(struct undoLog *log, int type, int row, int col, const char *s, int len){
+  // a new edit drops what could have been redone
+  if (log->cur < log->count){
+    log->text_len = log->ops[log->cur].text;
+    log->count = log->cur;
+  }
+
+  struct undoOp *last = log->cur > log->first && !log->group ? &log->ops[log->cur - 1] : NULL;
+
+  if (last && last->type == type && last->row == row){
+    if (type == UNDO_INSERT && col == last->col + last->len){
+      undoAppendText(log, s, len);
+      last->len += len;
+      undoTrim(log);
+      return;
+    }
+    if (type == UNDO_DELETE && col == last->col){
+      undoAppendText(log, s, len);
+      last->len += len;
+      undoTrim(log);
+      return;
+    }
+    if (type == UNDO_DELETE && col + len == last->col){
+      // deleting backwards: the text of the last op is at the end of the arena, shift it up
+      undoAppendText(log, s, len);
+      char *t = &log->text[last->text];
+      memmove(t + len, t, last->len);
+      memcpy(t, s, len);
+      last->col = col;
+      last->len += len;
+      undoTrim(log);
+      return;
+    }
+  }
+
+  if (log->count == log->cap){
+    log->cap = log->cap ? log->cap * 2 : 64;
+    log->ops = realloc(log->ops, sizeof(struct undoOp) * log->cap);
+    if (log->ops == NULL) die("realloc");
+  }
+
+  struct undoOp *op = &log->ops[log->count++];
+  op->type = type;
+  op->flags = log->group ? UNDO_GROUP : 0;
+  if (log->group) log->last = log->count - 1;
+  op->row = row;
+  op->col = col;
+  op->len = len;
+  op->text = log->text_len;
+  undoAppendText(log, s, len);
+
+  log->cur = log->count;
+  log->group = 0;
+  undoTrim(log);
+}
+
+/* steps back over one op and returns it for the caller to revert, NULL when there is nothing left */
+struct undoOp *undoPrev(struct undoLog *log){
+  log->group = 1;
+  if (log->cur == log->first) return NULL;
+  return &log->ops[--log->cur];
+}
+
+/* steps forward over one op and returns it for the caller to apply again, NULL when there is nothing left */
+struct undoOp *undoNext(struct undoLog *log){
+  log->group = 1;
+  if (log->cur == log->count) return NULL;
+  return &log->ops[log->cur++];
+}
+
+char *undoText(struct undoLog *log, struct undoOp *op){
+  return &log->text[op->text];
+}
@@ -0,0 +1,52 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+  #include <stddef.h>
+
+  /*
+    Undo history is a log of the primitive edits, oldest first. Each op
+    keeps its position and, for text, an offset into one append only
+    arena, so recording never copies more than the text that changed.
+    Typed characters and repeated deletes merge into the op before them.
+    Ops from `first` to `cur` can be undone, ops from `cur` to `count`
+    redone. When the log grows past its limit the oldest groups go, the
+    newest one stays whole however large it is.
+  */
+
+  enum undoType {
+    UNDO_INSERT = 1,    // text inserted into row at col
+    UNDO_DELETE,        // text deleted from row at col
+    UNDO_INSERT_ROW,    // row inserted at row with text
+    UNDO_DELETE_ROW     // row at row deleted, text was its contents
+  };
+
+  #define UNDO_GROUP (1<<0)  // first op of a group, undo and redo go a group at a time
+
+  struct undoOp {
+    unsigned char type;
+    unsigned char flags;
+    int row;
+    int col;
+    int len;
+    size_t text;
+  };
+
+  struct undoLog {
+    struct undoOp *ops;
+    int first, cur, count, cap;
+    char *text;
+    size_t text_first, text_len, text_cap;
+    size_t limit;        // bytes the ops and their text may take
+    int group;           // the next op starts a group
+    int last;            // first op of the newest group
+  };
+
+  void undoInit(struct undoLog *log, size_t limit);
+  void undoFree(struct undoLog *log);
+  void undoBreak(struct undoLog *log);
+  void undoRecord(struct undoLog *log, int type, int row, int col, const char *s, int len);
+  struct undoOp *undoPrev(struct undoLog *log);
+  struct undoOp *undoNext(struct undoLog *log);
+  char *undoText(struct undoLog *log, struct undoOp *op);
+
+#endif // !UNDO_H